@@ -65,10 +65,13 @@ int main(int argc, char **argv, char **env)
   uint64_t nodeID = 0;
   bool join = false;
   std::string address;
+  SnapshotCodec codec = CODEC_NONE;
   struct ::option opts[] = {
     {"nodeid", required_argument, nullptr, 0},
     {"addr", required_argument, nullptr, 1},
     {"join", no_argument, nullptr, 2},
+    {"snapshot_codec", required_argument, nullptr, 3},
+    {nullptr, 0, nullptr, 0},
   };
 
   while ((ret = getopt_long_only(argc, argv, "", opts, nullptr)) != -1) {
@@ -79,6 +82,12 @@ int main(int argc, char **argv, char **env)
         break;
       case 2:join = true;
         break;
+      case 3:
+        if (!ParseSnapshotCodec(optarg, &codec)) {
+          std::cerr << "unsupported snapshot codec " << optarg << std::endl;
+          return -1;
+        }
+        break;
       default:std::cerr << "unknown ret " << ret << std::endl;
     }
   }
@@ -114,35 +123,31 @@ int main(int argc, char **argv, char **env)
   nhconfig.RaftAddress = address;
 
   dragonboat::Status status;
+  auto watch = std::make_shared<WatchHub>();
   std::unique_ptr<dragonboat::NodeHost> nh(new dragonboat::NodeHost(nhconfig));
-  status = nh->StartCluster(peers, join, createDragonboatStateMachine, config);
+  status = nh->StartCluster(
+    peers, join,
+    [codec, watch](uint64_t clusterID, uint64_t nodeID)
+    {
+      return createDragonboatStateMachine(clusterID, nodeID, codec, watch);
+    }, config);
   if (!status.OK()) {
     std::cerr << "failed to StartCluster: " << status.Code() << std::endl;
     return -1;
   }
   std::atomic_bool readyToExit(false);
   auto timeout = dragonboat::Milliseconds(3000);
+  // the count is pushed by the state machine as each message is applied
+  auto sub = watch->Subscribe(countKey, false);
   auto readThread = std::thread(
-    [&nh, &readyToExit, &timeout]()
+    [&sub, &readyToExit]()
     {
-      size_t count = 0;
-      dragonboat::Buffer query(1);
-      dragonboat::Buffer result(sizeof(int));
-      while (true) {
-        if (count == 100) {
-          count = 0;
-          auto rs = nh->SyncRead(defaultClusterID, query, &result, timeout);
-          if (rs.OK()) {
-            auto c = result.Data();
-            std::cout << "count: " << *reinterpret_cast<const int *>(c)
-              << std::endl;
-          }
-        } else {
-          count++;
-          std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        }
-        if (readyToExit.load()) {
-          return;
+      WatchEvent event;
+      while (!readyToExit.load()) {
+        if (sub->Wait(&event, std::chrono::milliseconds(100))) {
+          std::cout
+            << "count: " << event.value << " at index " << event.index
+            << std::endl;
         }
       }
     });
@@ -191,6 +196,7 @@ int main(int argc, char **argv, char **env)
     }
   }
   readThread.join();
+  watch->Unsubscribe(sub);
   nh->Stop();
   return 0;
 }
\ No newline at end of file
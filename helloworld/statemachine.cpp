@@ -16,73 +16,58 @@
 #include <cstring>
 #include "statemachine.h"
 
-void HelloWorldStateMachine::update(dragonboat::Entry &ent) noexcept
+const CommandTable<HelloWorldStateMachine> &
+HelloWorldStateMachine::commands()
 {
-  auto c = reinterpret_cast<const char *>(ent.cmd);
-  std::cout << "message: " << std::string(c, ent.cmdLen) << std::endl;
+  // no verbs, every command is a message handled by fallback
+  static const CommandTable<HelloWorldStateMachine> table{};
+  return table;
+}
+
+uint64_t HelloWorldStateMachine::fallback(const CommandArgs &args)
+{
+  std::cout << "message: " << args.Raw().ToString() << std::endl;
   update_count_++;
-  ent.result = update_count_;
+  if (watch_ && watch_->Active()) {
+    watch_->Publish(
+      {args.Index(), WATCH_PUT, countKey, std::to_string(update_count_)});
+  }
+  return update_count_;
 }
 
-LookupResult HelloWorldStateMachine::lookup(
-  const dragonboat::Byte *data,
-  size_t size) const noexcept
+void HelloWorldStateMachine::query(
+  const StringRef &query,
+  std::string *result) const
 {
-  LookupResult r;
-  r.result = new char[sizeof(int)];
-  r.size = sizeof(int);
-  std::memcpy(r.result, &update_count_, sizeof(int));
-  return r;
+  result->assign(reinterpret_cast<const char *>(&update_count_), sizeof(int));
 }
 
-uint64_t HelloWorldStateMachine::getHash() const noexcept
+uint64_t HelloWorldStateMachine::hash() const
 {
   return static_cast<uint64_t>(update_count_);
 }
 
-SnapshotResult HelloWorldStateMachine::saveSnapshot(
-  dragonboat::SnapshotWriter *writer,
-  dragonboat::SnapshotFileCollection *collection,
-  const dragonboat::DoneChan &done) const noexcept
+bool HelloWorldStateMachine::save(SnapshotStreamWriter *stream) const
 {
-  SnapshotResult r;
-  dragonboat::IOResult ret;
-  r.errcode = SNAPSHOT_OK;
-  r.size = 0;
-  ret = writer->Write(
-    reinterpret_cast<const dragonboat::Byte *>(&update_count_),
-    sizeof(int));
-  if (ret.size != sizeof(int)) {
-    r.errcode = FAILED_TO_SAVE_SNAPSHOT;
-    return r;
-  }
-  r.size = sizeof(int);
-  return r;
+  return stream->Write(
+    reinterpret_cast<const char *>(&update_count_), sizeof(int));
 }
 
-int HelloWorldStateMachine::recoverFromSnapshot(
-  dragonboat::SnapshotReader *reader,
-  const std::vector<dragonboat::SnapshotFile> &files,
-  const dragonboat::DoneChan &done) noexcept
+bool HelloWorldStateMachine::recover(SnapshotStreamReader *stream)
 {
-  dragonboat::IOResult ret;
-  dragonboat::Byte data[sizeof(int)];
-  ret = reader->Read(data, sizeof(int));
-  if (ret.size != sizeof(int)) {
-    return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+  char data[sizeof(int)];
+  if (stream->Read(data, sizeof(int)) != sizeof(int)) {
+    return false;
   }
   std::memcpy(&update_count_, data, sizeof(int));
-  return SNAPSHOT_OK;
-}
-
-void HelloWorldStateMachine::freeLookupResult(LookupResult r) noexcept
-{
-  delete[] r.result;
+  return true;
 }
 
 dragonboat::RegularStateMachine *createDragonboatStateMachine(
   uint64_t clusterID,
-  uint64_t nodeID)
+  uint64_t nodeID,
+  SnapshotCodec codec,
+  std::shared_ptr<WatchHub> watch)
 {
-  return new HelloWorldStateMachine(clusterID, nodeID);
+  return new HelloWorldStateMachine(clusterID, nodeID, codec, watch);
 }
\ No newline at end of file
@@ -15,37 +15,46 @@
 #ifndef DRAGONBOAT_CPP_EXAMPLE_STATEMACHINE_H
 #define DRAGONBOAT_CPP_EXAMPLE_STATEMACHINE_H
 
-#include "dragonboat/statemachine/regular.h"
 #include <vector>
+#include <memory>
+#include "statemachinebase.h"
+#include "watchhub.h"
 
-class HelloWorldStateMachine : public dragonboat::RegularStateMachine {
+// the key of the events published on every update, the value is the count
+const std::string countKey = "count";
+
+// every command is a message, the result of an update and of a lookup is the
+// number of messages so far
+class HelloWorldStateMachine
+  : public RegularStateMachineBase<HelloWorldStateMachine> {
  public:
-  HelloWorldStateMachine(uint64_t clusterID, uint64_t nodeID) noexcept
-    : RegularStateMachine(clusterID, nodeID), update_count_(0)
+  HelloWorldStateMachine(
+    uint64_t clusterID,
+    uint64_t nodeID,
+    SnapshotCodec codec = CODEC_NONE,
+    std::shared_ptr<WatchHub> watch = nullptr) noexcept
+    : RegularStateMachineBase(clusterID, nodeID, codec), update_count_(0),
+      watch_(std::move(watch))
   {}
   ~HelloWorldStateMachine() noexcept override = default;
- protected:
-  void update(dragonboat::Entry &ent) noexcept override;
-  LookupResult lookup(
-    const dragonboat::Byte *data,
-    size_t size) const noexcept override;
-  uint64_t getHash() const noexcept override;
-  SnapshotResult saveSnapshot(
-    dragonboat::SnapshotWriter *writer,
-    dragonboat::SnapshotFileCollection *collection,
-    const dragonboat::DoneChan &done) const noexcept override;
-  int recoverFromSnapshot(
-    dragonboat::SnapshotReader *reader,
-    const std::vector<dragonboat::SnapshotFile> &files,
-    const dragonboat::DoneChan &done) noexcept override;
-  void freeLookupResult(LookupResult r) noexcept override;
  private:
+  friend class RegularStateMachineBase<HelloWorldStateMachine>;
   DISALLOW_COPY_MOVE_AND_ASSIGN(HelloWorldStateMachine);
+  static const CommandTable<HelloWorldStateMachine> &commands();
+  uint64_t fallback(const CommandArgs &args);
+  void query(const StringRef &query, std::string *result) const;
+  uint64_t hash() const;
+  bool save(SnapshotStreamWriter *stream) const;
+  bool recover(SnapshotStreamReader *stream);
   int update_count_;
+  // nullptr if updates are not published
+  const std::shared_ptr<WatchHub> watch_;
 };
 
 dragonboat::RegularStateMachine *createDragonboatStateMachine(
   uint64_t clusterID,
-  uint64_t nodeID);
+  uint64_t nodeID,
+  SnapshotCodec codec,
+  std::shared_ptr<WatchHub> watch);
 
 #endif //DRAGONBOAT_CPP_EXAMPLE_STATEMACHINE_H
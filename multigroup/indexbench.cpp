@@ -0,0 +1,265 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "indexbench.h"
+#include "kvindex.h"
+#include "bloomfilter.h"
+#include "statemachinebase.h"
+#include "utils.h"
+
+static uint64_t nowNanos() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// count distinct keys in random order
+static std::vector<std::string> benchKeys(uint64_t count)
+{
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    keys.push_back("key" + std::to_string(i));
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(count));
+  return keys;
+}
+
+void runIndexBench(uint64_t count)
+{
+  auto keys = benchKeys(std::max<uint64_t>(count, 1));
+  // enough gets to average out the timer
+  uint64_t gets = std::max<uint64_t>(keys.size(), 1000000);
+  std::string value(16, 'v');
+  for (auto type : {INDEX_HASH, INDEX_BTREE}) {
+    auto index = NewKVIndex(type);
+    for (auto &key : keys) {
+      index->Put(key, value);
+    }
+    uint64_t found = 0;
+    StringRef ref;
+    auto start = nowNanos();
+    for (uint64_t i = 0; i < gets; ++i) {
+      found += index->Get(keys[(i * 7919) % keys.size()], &ref);
+    }
+    auto getNanos = (nowNanos() - start) / gets;
+    uint64_t scanned = 0;
+    start = nowNanos();
+    index->Scan(
+      "", "", SIZE_MAX,
+      [&scanned](const StringRef &, const StringRef &)
+      {
+        scanned++;
+        return true;
+      });
+    auto scanMicros = (nowNanos() - start) / 1000;
+    std::cout
+      << (type == INDEX_HASH ? "hash" : "btree") << ": " << keys.size()
+      << " keys, get " << getNanos << "ns, full scan " << scanMicros
+      << "us, " << found << " found, " << scanned << " scanned" << std::endl;
+  }
+}
+
+void runFilterBench(uint64_t count, size_t bitsPerKey)
+{
+  auto keys = benchKeys(std::max<uint64_t>(count, 1));
+  std::string value(16, 'v');
+  auto index = NewKVIndex(INDEX_HASH);
+  BlockedBloomFilter filter(keys.size(), bitsPerKey);
+  for (auto &key : keys) {
+    index->Put(key, value);
+    filter.Add(key.data(), key.size());
+  }
+  uint64_t lookups = std::max<uint64_t>(keys.size(), 1000000);
+  for (uint64_t missPercent : {0, 30, 60, 90}) {
+    // the same mix of hits and misses for both runs
+    std::vector<std::string> queries;
+    queries.reserve(keys.size());
+    for (uint64_t i = 0; i < keys.size(); ++i) {
+      queries.push_back(
+        (i * 7919) % 100 < missPercent ? "miss" + std::to_string(i) : keys[i]);
+    }
+    uint64_t nanos[2];
+    uint64_t found[2] = {0, 0};
+    for (int withFilter = 0; withFilter < 2; ++withFilter) {
+      auto start = nowNanos();
+      for (uint64_t i = 0; i < lookups; ++i) {
+        auto &query = queries[(i * 7919) % queries.size()];
+        StringRef ref;
+        if ((withFilter && !filter.MayContain(query.data(), query.size()))
+          || !index->Get(query, &ref)) {
+          continue;
+        }
+        std::unique_ptr<char[]> result(new char[ref.size]);
+        std::memcpy(result.get(), ref.data, ref.size);
+        found[withFilter]++;
+      }
+      nanos[withFilter] = (nowNanos() - start) / lookups;
+    }
+    std::cout
+      << missPercent << "% misses: " << nanos[0] << "ns without, "
+      << nanos[1] << "ns with the filter, " << found[1] << "/" << found[0]
+      << " found" << std::endl;
+  }
+  std::cout
+    << keys.size() << " keys, filter " << filter.MemoryBytes() << " bytes"
+    << std::endl;
+}
+
+// the map and commands shared by both dispatchers
+class BenchMap {
+ public:
+  uint64_t Set(const std::string &key, const std::string &value)
+  {
+    map_[key] = value;
+    return 1;
+  }
+  uint64_t Incr(const std::string &key, uint64_t delta)
+  {
+    auto &value = map_[key];
+    value = std::to_string(std::strtoull(value.c_str(), nullptr, 10) + delta);
+    return 1;
+  }
+  uint64_t Del(const std::string &key)
+  {
+    map_.erase(key);
+    return 1;
+  }
+  size_t Size() const
+  {
+    return map_.size();
+  }
+ private:
+  std::unordered_map<std::string, std::string> map_;
+};
+
+// dispatches the way the examples did before RegularStateMachineBase
+static uint64_t applySplit(BenchMap *map, const std::string &cmd)
+{
+  auto parts = split(cmd);
+  if (parts[0] == "set" && parts.size() == 3) {
+    return map->Set(parts[1], parts[2]);
+  } else if (parts[0] == "incr" && parts.size() == 3) {
+    return map->Incr(parts[1], std::strtoull(parts[2].c_str(), nullptr, 10));
+  } else if (parts[0] == "del" && parts.size() == 2) {
+    return map->Del(parts[1]);
+  }
+  return 0;
+}
+
+class BenchStateMachine : public RegularStateMachineBase<BenchStateMachine> {
+ public:
+  BenchStateMachine() noexcept : RegularStateMachineBase(0, 0) {}
+  uint64_t Apply(const std::string &cmd)
+  {
+    dragonboat::Entry ent;
+    ent.index = 0;
+    ent.cmd = reinterpret_cast<const dragonboat::Byte *>(cmd.data());
+    ent.cmdLen = cmd.size();
+    ent.result = 0;
+    update(ent);
+    return ent.result;
+  }
+  BenchMap map;
+ private:
+  friend class RegularStateMachineBase<BenchStateMachine>;
+  static const CommandTable<BenchStateMachine> &commands()
+  {
+    static const CommandTable<BenchStateMachine> table{
+      {"set", 2, 2, &BenchStateMachine::set},
+      {"incr", 2, 2, &BenchStateMachine::incr},
+      {"del", 1, 1, &BenchStateMachine::del},
+    };
+    return table;
+  }
+  uint64_t set(const CommandArgs &args)
+  {
+    return map.Set(args[1].ToString(), args[2].ToString());
+  }
+  uint64_t incr(const CommandArgs &args)
+  {
+    uint64_t delta;
+    return args.Uint64(2, &delta) ? map.Incr(args[1].ToString(), delta) : 0;
+  }
+  uint64_t del(const CommandArgs &args)
+  {
+    return map.Del(args[1].ToString());
+  }
+  void query(const StringRef &query, std::string *result) const
+  {}
+  uint64_t hash() const
+  {
+    return 0;
+  }
+  bool save(SnapshotStreamWriter *stream) const
+  {
+    return true;
+  }
+  bool recover(SnapshotStreamReader *stream)
+  {
+    return true;
+  }
+};
+
+void runApplyBench(uint64_t count)
+{
+  auto keys = benchKeys(1000);
+  std::vector<std::string> cmds;
+  cmds.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    auto &key = keys[i % keys.size()];
+    switch (i % 3) {
+      case 0:cmds.push_back("set " + key + " " + std::to_string(i));
+        break;
+      case 1:cmds.push_back("incr " + key + " 1");
+        break;
+      default:cmds.push_back("del " + key);
+        break;
+    }
+  }
+  BenchMap map;
+  uint64_t applied = 0;
+  auto start = nowNanos();
+  for (auto &cmd : cmds) {
+    applied += applySplit(&map, cmd);
+  }
+  auto splitNanos = nowNanos() - start;
+  std::cout
+    << "split: " << applied << " commands, "
+    << splitNanos / std::max<uint64_t>(count, 1) << "ns per command"
+    << std::endl;
+  std::unique_ptr<BenchStateMachine> sm(new BenchStateMachine());
+  applied = 0;
+  start = nowNanos();
+  for (auto &cmd : cmds) {
+    applied += sm->Apply(cmd);
+  }
+  auto tableNanos = nowNanos() - start;
+  std::cout
+    << "table: " << applied << " commands, "
+    << tableNanos / std::max<uint64_t>(count, 1) << "ns per command"
+    << std::endl;
+}
@@ -0,0 +1,36 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_INDEXBENCH_H_
+#define DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_INDEXBENCH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// fills a hash and a B+tree index with count keys in this process, not in
+// the clusters, and prints the latency of point gets and of a full ordered
+// scan of each
+void runIndexBench(uint64_t count);
+// fills a hash index and a Bloom filter of bitsPerKey with count keys in
+// this process and prints the lookup latency without and with the filter at
+// 0, 30, 60 and 90% misses, a lookup copies the value found like the state
+// machine does
+void runFilterBench(uint64_t count, size_t bitsPerKey);
+// applies count set/incr/del commands to an in-memory map in this process,
+// once dispatched with split and string compares and once through the
+// command table of RegularStateMachineBase, and prints the latency of each
+void runApplyBench(uint64_t count);
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_INDEXBENCH_H_
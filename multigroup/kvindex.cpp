@@ -0,0 +1,405 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include "kvindex.h"
+
+bool ParseIndexType(const std::string &name, IndexType *type)
+{
+  if (name == "hash") {
+    *type = INDEX_HASH;
+  } else if (name == "btree") {
+    *type = INDEX_BTREE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string IndexMemory::ToString() const
+{
+  std::stringstream ss;
+  ss << "keys: " << keys << "\n"
+     << "data_bytes: " << dataBytes << "\n"
+     << "arena_bytes: " << arenaBytes << "\n"
+     << "garbage_bytes: " << garbageBytes << "\n"
+     << "index_bytes: " << indexBytes << "\n"
+     << "total_bytes: " << TotalBytes();
+  return ss.str();
+}
+
+IndexMemory KVIndex::Memory() const
+{
+  IndexMemory m;
+  m.keys = Size();
+  m.dataBytes = arena_.LiveBytes();
+  m.arenaBytes = arena_.AllocatedBytes();
+  m.garbageBytes = arena_.GarbageBytes();
+  m.indexBytes = indexBytes();
+  return m;
+}
+
+bool KVIndex::MaybeCompact(size_t minGarbageBytes)
+{
+  if (arena_.GarbageBytes() < minGarbageBytes
+    || arena_.GarbageBytes() <= arena_.LiveBytes()) {
+    return false;
+  }
+  Arena arena;
+  relocate(&arena);
+  arena_.Swap(arena);
+  return true;
+}
+
+std::unique_ptr<KVIndex> NewKVIndex(IndexType type)
+{
+  if (type == INDEX_BTREE) {
+    return std::unique_ptr<KVIndex>(new BTreeIndex());
+  }
+  return std::unique_ptr<KVIndex>(new HashIndex());
+}
+
+std::string PrefixEnd(const std::string &prefix)
+{
+  std::string end = prefix;
+  while (!end.empty()) {
+    auto c = static_cast<unsigned char>(end.back());
+    if (c != 0xff) {
+      end.back() = static_cast<char>(c + 1);
+      return end;
+    }
+    end.pop_back();
+  }
+  return end;
+}
+
+bool HashIndex::Get(const std::string &key, StringRef *value) const
+{
+  auto it = map_.find(key);
+  if (it == map_.end()) {
+    return false;
+  }
+  *value = it->second;
+  return true;
+}
+
+void HashIndex::Put(const std::string &key, const std::string &value)
+{
+  auto it = map_.find(key);
+  if (it != map_.end()) {
+    arena_.Free(it->second);
+    it->second = arena_.Add(value.data(), value.size());
+  } else {
+    auto k = arena_.Add(key.data(), key.size());
+    map_.emplace(k, arena_.Add(value.data(), value.size()));
+  }
+}
+
+void HashIndex::Erase(const std::string &key)
+{
+  auto it = map_.find(key);
+  if (it != map_.end()) {
+    arena_.Free(it->first);
+    arena_.Free(it->second);
+    map_.erase(it);
+  }
+}
+
+void HashIndex::Clear()
+{
+  map_.clear();
+  arena_.Clear();
+}
+
+size_t HashIndex::Size() const
+{
+  return map_.size();
+}
+
+void HashIndex::Scan(
+  const std::string &begin,
+  const std::string &end,
+  size_t maxVisits,
+  const KVVisitor &visitor) const
+{
+  if (maxVisits == 0) {
+    return;
+  }
+  using Item = const std::pair<const StringRef, StringRef> *;
+  auto less = [](Item x, Item y) { return x->first < y->first; };
+  // max-heap of the smallest keys in range seen so far
+  std::vector<Item> items;
+  StringRef b(begin);
+  StringRef e(end);
+  for (auto &item : map_) {
+    if (item.first < b || (!end.empty() && item.first >= e)) {
+      continue;
+    }
+    if (items.size() < maxVisits) {
+      items.push_back(&item);
+      std::push_heap(items.begin(), items.end(), less);
+    } else if (item.first < items.front()->first) {
+      std::pop_heap(items.begin(), items.end(), less);
+      items.back() = &item;
+      std::push_heap(items.begin(), items.end(), less);
+    }
+  }
+  std::sort_heap(items.begin(), items.end(), less);
+  for (auto item : items) {
+    if (!visitor(item->first, item->second)) {
+      return;
+    }
+  }
+}
+
+void HashIndex::ForEach(const KVVisitor &visitor) const
+{
+  for (auto &item : map_) {
+    if (!visitor(item.first, item.second)) {
+      return;
+    }
+  }
+}
+
+void HashIndex::relocate(Arena *arena)
+{
+  std::unordered_map<StringRef, StringRef, StringRefHash> map;
+  map.reserve(map_.size());
+  for (auto &item : map_) {
+    map.emplace(arena->Add(item.first), arena->Add(item.second));
+  }
+  map_.swap(map);
+}
+
+size_t HashIndex::indexBytes() const
+{
+  // libstdc++ nodes hold the next pointer, the pair and the cached hash
+  constexpr size_t nodeBytes = sizeof(void *)
+    + sizeof(std::pair<const StringRef, StringRef>) + sizeof(size_t);
+  return sizeof(map_) + map_.bucket_count() * sizeof(void *)
+    + map_.size() * nodeBytes;
+}
+
+BTreeIndex::BTreeIndex()
+  : root_(new Node(true)), size_(0)
+{
+}
+
+BTreeIndex::Node *BTreeIndex::findLeaf(const StringRef &key) const
+{
+  auto node = root_.get();
+  while (!node->leaf) {
+    auto i = std::upper_bound(
+      node->seps.begin(), node->seps.end(), key,
+      [](const StringRef &k, const std::string &sep)
+      {
+        return k < StringRef(sep);
+      }) - node->seps.begin();
+    node = node->children[i].get();
+  }
+  return node;
+}
+
+BTreeIndex::Node *BTreeIndex::firstLeaf() const
+{
+  auto node = root_.get();
+  while (!node->leaf) {
+    node = node->children.front().get();
+  }
+  return node;
+}
+
+bool BTreeIndex::Get(const std::string &key, StringRef *value) const
+{
+  StringRef k(key);
+  auto leaf = findLeaf(k);
+  auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), k);
+  if (it == leaf->keys.end() || *it != k) {
+    return false;
+  }
+  *value = leaf->values[it - leaf->keys.begin()];
+  return true;
+}
+
+bool BTreeIndex::insert(
+  Node *node,
+  const std::string &key,
+  const std::string &value,
+  std::string *sep,
+  std::unique_ptr<Node> *right)
+{
+  StringRef k(key);
+  if (node->leaf) {
+    auto it = std::lower_bound(node->keys.begin(), node->keys.end(), k);
+    auto i = it - node->keys.begin();
+    if (it != node->keys.end() && *it == k) {
+      arena_.Free(node->values[i]);
+      node->values[i] = arena_.Add(value.data(), value.size());
+      return false;
+    }
+    node->keys.insert(it, arena_.Add(key.data(), key.size()));
+    node->values.insert(
+      node->values.begin() + i, arena_.Add(value.data(), value.size()));
+    size_++;
+    if (node->keys.size() <= maxKeys) {
+      return false;
+    }
+    auto mid = node->keys.size() / 2;
+    right->reset(new Node(true));
+    auto r = right->get();
+    r->keys.assign(node->keys.begin() + mid, node->keys.end());
+    r->values.assign(node->values.begin() + mid, node->values.end());
+    node->keys.resize(mid);
+    node->values.resize(mid);
+    r->next = node->next;
+    node->next = r;
+    *sep = r->keys.front().ToString();
+    return true;
+  }
+  auto i = std::upper_bound(
+    node->seps.begin(), node->seps.end(), k,
+    [](const StringRef &x, const std::string &s) { return x < StringRef(s); })
+    - node->seps.begin();
+  std::string childSep;
+  std::unique_ptr<Node> childRight;
+  if (!insert(node->children[i].get(), key, value, &childSep, &childRight)) {
+    return false;
+  }
+  node->seps.insert(node->seps.begin() + i, std::move(childSep));
+  node->children.insert(
+    node->children.begin() + i + 1, std::move(childRight));
+  if (node->seps.size() <= maxKeys) {
+    return false;
+  }
+  auto mid = node->seps.size() / 2;
+  right->reset(new Node(false));
+  auto r = right->get();
+  *sep = std::move(node->seps[mid]);
+  std::move(
+    node->seps.begin() + mid + 1, node->seps.end(),
+    std::back_inserter(r->seps));
+  std::move(
+    node->children.begin() + mid + 1, node->children.end(),
+    std::back_inserter(r->children));
+  node->seps.resize(mid);
+  node->children.resize(mid + 1);
+  return true;
+}
+
+void BTreeIndex::Put(const std::string &key, const std::string &value)
+{
+  std::string sep;
+  std::unique_ptr<Node> right;
+  if (insert(root_.get(), key, value, &sep, &right)) {
+    std::unique_ptr<Node> root(new Node(false));
+    root->seps.push_back(std::move(sep));
+    root->children.push_back(std::move(root_));
+    root->children.push_back(std::move(right));
+    root_ = std::move(root);
+  }
+}
+
+void BTreeIndex::Erase(const std::string &key)
+{
+  StringRef k(key);
+  auto leaf = findLeaf(k);
+  auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), k);
+  if (it == leaf->keys.end() || *it != k) {
+    return;
+  }
+  auto i = it - leaf->keys.begin();
+  arena_.Free(*it);
+  arena_.Free(leaf->values[i]);
+  leaf->values.erase(leaf->values.begin() + i);
+  leaf->keys.erase(it);
+  size_--;
+}
+
+void BTreeIndex::Clear()
+{
+  root_.reset(new Node(true));
+  size_ = 0;
+  arena_.Clear();
+}
+
+size_t BTreeIndex::Size() const
+{
+  return size_;
+}
+
+void BTreeIndex::Scan(
+  const std::string &begin,
+  const std::string &end,
+  size_t maxVisits,
+  const KVVisitor &visitor) const
+{
+  StringRef b(begin);
+  StringRef e(end);
+  auto leaf = findLeaf(b);
+  auto i = static_cast<size_t>(
+    std::lower_bound(leaf->keys.begin(), leaf->keys.end(), b)
+      - leaf->keys.begin());
+  for (; leaf != nullptr; leaf = leaf->next, i = 0) {
+    for (; i < leaf->keys.size(); ++i) {
+      if (maxVisits-- == 0 || (!end.empty() && leaf->keys[i] >= e)) {
+        return;
+      }
+      if (!visitor(leaf->keys[i], leaf->values[i])) {
+        return;
+      }
+    }
+  }
+}
+
+void BTreeIndex::ForEach(const KVVisitor &visitor) const
+{
+  Scan("", "", SIZE_MAX, visitor);
+}
+
+void BTreeIndex::relocate(Arena *arena)
+{
+  for (auto leaf = firstLeaf(); leaf != nullptr; leaf = leaf->next) {
+    for (size_t i = 0; i < leaf->keys.size(); ++i) {
+      leaf->keys[i] = arena->Add(leaf->keys[i]);
+      leaf->values[i] = arena->Add(leaf->values[i]);
+    }
+  }
+}
+
+size_t BTreeIndex::nodeBytes(const Node *node) const
+{
+  size_t bytes = sizeof(Node)
+    + node->seps.capacity() * sizeof(std::string)
+    + node->children.capacity() * sizeof(std::unique_ptr<Node>)
+    + (node->keys.capacity() + node->values.capacity()) * sizeof(StringRef);
+  for (auto &sep : node->seps) {
+    // the SSO buffer is already counted
+    if (sep.capacity() > 15) {
+      bytes += sep.capacity() + 1;
+    }
+  }
+  for (auto &child : node->children) {
+    bytes += nodeBytes(child.get());
+  }
+  return bytes;
+}
+
+size_t BTreeIndex::indexBytes() const
+{
+  return nodeBytes(root_.get());
+}
@@ -0,0 +1,158 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_KVINDEX_H_
+#define DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_KVINDEX_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "arena.h"
+
+enum IndexType {
+  INDEX_HASH,
+  INDEX_BTREE,
+};
+
+bool ParseIndexType(const std::string &name, IndexType *type);
+
+// returns false to stop a Scan, the refs are valid until the index is updated
+using KVVisitor = std::function<bool(const StringRef &, const StringRef &)>;
+
+// memory used by an index, in bytes
+struct IndexMemory {
+  size_t keys;
+  // sum of the sizes of all keys and values
+  size_t dataBytes;
+  // arena blocks holding the keys and values, including garbage
+  size_t arenaBytes;
+  size_t garbageBytes;
+  // containers and nodes of the index itself
+  size_t indexBytes;
+  size_t TotalBytes() const { return arenaBytes + indexBytes; }
+  std::string ToString() const;
+};
+
+// in-memory index of the KV store, keys and values are stored in an arena
+// owned by the index
+class KVIndex {
+ public:
+  virtual ~KVIndex() = default;
+  // returns false if key is not found
+  virtual bool Get(const std::string &key, StringRef *value) const = 0;
+  virtual void Put(const std::string &key, const std::string &value) = 0;
+  virtual void Erase(const std::string &key) = 0;
+  virtual void Clear() = 0;
+  virtual size_t Size() const = 0;
+  // visits at most maxVisits keys in [begin, end) in key order, an empty end
+  // means no upper bound
+  virtual void Scan(
+    const std::string &begin,
+    const std::string &end,
+    size_t maxVisits,
+    const KVVisitor &visitor) const = 0;
+  // visits all keys in the order cheapest for the index
+  virtual void ForEach(const KVVisitor &visitor) const = 0;
+  // sum of the sizes of all keys and values, the same on all replicas
+  size_t DataBytes() const { return arena_.LiveBytes(); }
+  IndexMemory Memory() const;
+  // copies the live keys and values into a new arena once the garbage exceeds
+  // both the live bytes and minGarbageBytes, returns true if compacted
+  bool MaybeCompact(size_t minGarbageBytes);
+ protected:
+  // moves all keys and values into arena
+  virtual void relocate(Arena *arena) = 0;
+  virtual size_t indexBytes() const = 0;
+  Arena arena_;
+};
+
+std::unique_ptr<KVIndex> NewKVIndex(IndexType type);
+
+// returns the smallest key greater than all keys starting with prefix, empty
+// if there is none
+std::string PrefixEnd(const std::string &prefix);
+
+// unordered_map, Scan selects the smallest maxVisits keys in range with a
+// bounded heap, so it takes O(n log maxVisits) time and O(maxVisits) memory
+class HashIndex : public KVIndex {
+ public:
+  bool Get(const std::string &key, StringRef *value) const override;
+  void Put(const std::string &key, const std::string &value) override;
+  void Erase(const std::string &key) override;
+  void Clear() override;
+  size_t Size() const override;
+  void Scan(
+    const std::string &begin,
+    const std::string &end,
+    size_t maxVisits,
+    const KVVisitor &visitor) const override;
+  void ForEach(const KVVisitor &visitor) const override;
+ protected:
+  void relocate(Arena *arena) override;
+  size_t indexBytes() const override;
+ private:
+  std::unordered_map<StringRef, StringRef, StringRefHash> map_;
+};
+
+// B+tree keeping the keys and values of a leaf in contiguous arrays and the
+// leaves linked in key order, Erase does not merge underfull leaves
+class BTreeIndex : public KVIndex {
+ public:
+  BTreeIndex();
+  bool Get(const std::string &key, StringRef *value) const override;
+  void Put(const std::string &key, const std::string &value) override;
+  void Erase(const std::string &key) override;
+  void Clear() override;
+  size_t Size() const override;
+  void Scan(
+    const std::string &begin,
+    const std::string &end,
+    size_t maxVisits,
+    const KVVisitor &visitor) const override;
+  void ForEach(const KVVisitor &visitor) const override;
+ protected:
+  void relocate(Arena *arena) override;
+  size_t indexBytes() const override;
+ private:
+  struct Node {
+    explicit Node(bool isLeaf) : leaf(isLeaf), next(nullptr) {}
+    bool leaf;
+    // inner only, children[i] holds the keys in [seps[i - 1], seps[i]),
+    // separators are owned by the node as leaf keys may be freed
+    std::vector<std::string> seps;
+    std::vector<std::unique_ptr<Node>> children;
+    // leaf only
+    std::vector<StringRef> keys;
+    std::vector<StringRef> values;
+    Node *next;
+  };
+  static constexpr size_t maxKeys = 64;
+  Node *findLeaf(const StringRef &key) const;
+  Node *firstLeaf() const;
+  // returns true if node was split into node and *right, separated by *sep
+  bool insert(
+    Node *node,
+    const std::string &key,
+    const std::string &value,
+    std::string *sep,
+    std::unique_ptr<Node> *right);
+  size_t nodeBytes(const Node *node) const;
+  std::unique_ptr<Node> root_;
+  size_t size_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_KVINDEX_H_
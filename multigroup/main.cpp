@@ -19,8 +19,14 @@
 #include <atomic>
 #include <thread>
 #include <algorithm>
+#include <vector>
+#include <chrono>
+#include <functional>
 #include "dragonboat/dragonboat.h"
 #include "statemachines.h"
+#include "readcoordinator.h"
+#include "indexbench.h"
+#include "ticker.h"
 #include "utils.h"
 
 constexpr uint64_t ClusterID1 = 1;
@@ -32,21 +38,118 @@ constexpr char addresses[3][16] = {
   "localhost:63003",
 };
 
+// sets count keys from concurrency threads, through the batcher of the
+// cluster owning the key if batchers is not empty
+void runBench(
+  dragonboat::NodeHost *nh,
+  const std::vector<std::unique_ptr<ProposalBatcher>> &batchers,
+  uint64_t count,
+  uint64_t concurrency,
+  dragonboat::Milliseconds timeout)
+{
+  std::atomic<uint64_t> next(0);
+  std::atomic<uint64_t> failed(0);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < concurrency; ++t) {
+    threads.emplace_back([nh, &batchers, count, timeout, &next, &failed]()
+    {
+      std::unique_ptr<dragonboat::Session> sessions[2] = {
+        std::unique_ptr<dragonboat::Session>(nh->GetNoOPSession(ClusterID1)),
+        std::unique_ptr<dragonboat::Session>(nh->GetNoOPSession(ClusterID2)),
+      };
+      for (auto i = next++; i < count; i = next++) {
+        auto key = "bench" + std::to_string(i);
+        auto cmd = "set " + key + " " + std::to_string(i);
+        auto idx = std::hash<std::string>()(key) % 2;
+        dragonboat::Status status;
+        uint64_t ret = 0;
+        if (!batchers.empty()) {
+          status = batchers[idx]->Propose(cmd, &ret);
+        } else {
+          dragonboat::Buffer buf(
+            reinterpret_cast<const dragonboat::Byte *>(cmd.c_str()),
+            cmd.size());
+          status = nh->SyncPropose(sessions[idx].get(), buf, timeout, &ret);
+        }
+        if (!status.OK() || ret == 0) {
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  std::cout
+    << count << " sets in " << ms << "ms, "
+    << count * 1000 / std::max<uint64_t>(ms, 1) << " sets/s, "
+    << failed.load() << " failed" << std::endl;
+  for (auto &batcher : batchers) {
+    std::cout << batcher->ToString() << std::endl;
+  }
+}
+
 int main(int argc, char **argv, char **env)
 {
   int ret;
   uint64_t nodeID = 0;
   bool join = false;
   std::string address;
+  KVStoreOptions options;
+  // client-side proposal batching, disabled if maxBytes is 0
+  ProposalBatcherOptions batchOptions;
+  batchOptions.maxBytes = 0;
+  batchOptions.resultBits = batchResultBits;
+  // reads share ReadIndex requests if readWindowMicros is not 0
+  uint64_t readWindowMicros = 0;
+  uint64_t tickMillis = 1000;
+  // proposed to both clusters once started if not 0
+  uint64_t memQuotaBytes = 0;
   // for simplicity, membership change is removed in this example
   struct ::option opts[] = {
     {"nodeid", required_argument, nullptr, 0},
+    {"snapshot_codec", required_argument, nullptr, 1},
+    {"index", required_argument, nullptr, 2},
+    {"mem_quota_mb", required_argument, nullptr, 3},
+    {"bloom_bits", required_argument, nullptr, 4},
+    {"batch_kb", required_argument, nullptr, 5},
+    {"batch_us", required_argument, nullptr, 6},
+    {"read_window_us", required_argument, nullptr, 7},
+    {"tick_ms", required_argument, nullptr, 8},
+    {nullptr, 0, nullptr, 0},
   };
 
   while ((ret = getopt_long_only(argc, argv, "", opts, nullptr)) != -1) {
     switch (ret) {
       case 0:nodeID = std::stoull(optarg);
         break;
+      case 1:
+        if (!ParseSnapshotCodec(optarg, &options.codec)) {
+          std::cerr << "unsupported snapshot codec " << optarg << std::endl;
+          return -1;
+        }
+        break;
+      case 2:
+        if (!ParseIndexType(optarg, &options.index)) {
+          std::cerr << "unknown index " << optarg << std::endl;
+          return -1;
+        }
+        break;
+      case 3:memQuotaBytes = std::stoull(optarg) * 1024 * 1024;
+        break;
+      case 4:options.bloomBitsPerKey = std::stoull(optarg);
+        break;
+      case 5:batchOptions.maxBytes = std::stoull(optarg) * 1024;
+        break;
+      case 6:batchOptions.lingerMicros = std::stoull(optarg);
+        break;
+      case 7:readWindowMicros = std::stoull(optarg);
+        break;
+      case 8:tickMillis = std::stoull(optarg);
+        break;
       default:std::cerr << "unknown ret " << ret << std::endl;
     }
   }
@@ -78,14 +181,26 @@ int main(int argc, char **argv, char **env)
 
   dragonboat::Status status;
   std::unique_ptr<dragonboat::NodeHost> nh(new dragonboat::NodeHost(nhconfig));
-  status = nh->StartCluster(peers, join, createDragonboatStateMachine, config);
+  // one watch hub per cluster as each is fed by the apply path of a single
+  // state machine
+  std::shared_ptr<WatchHub> watches[2] = {
+    std::make_shared<WatchHub>(),
+    std::make_shared<WatchHub>(),
+  };
+  auto factory = [options, watches](uint64_t clusterID, uint64_t nodeID)
+  {
+    auto clusterOptions = options;
+    clusterOptions.watch = watches[clusterID - ClusterID1];
+    return createDragonboatStateMachine(clusterID, nodeID, clusterOptions);
+  };
+  status = nh->StartCluster(peers, join, factory, config);
   if (!status.OK()) {
     std::cerr << "failed to StartCluster: " << status.Code() << std::endl;
     return -1;
   }
 
   config.ClusterId = ClusterID2;
-  status = nh->StartCluster(peers, join, createDragonboatStateMachine, config);
+  status = nh->StartCluster(peers, join, factory, config);
   if (!status.OK()) {
     std::cerr << "failed to StartCluster: " << status.Code() << std::endl;
     return -1;
@@ -94,10 +209,251 @@ int main(int argc, char **argv, char **env)
   // supported command:
   // set key value
   // key
-  // display clusterID
+  // display clusterID [page_kb]
+  // scan clusterID begin [end [limit]]
+  // prefix clusterID prefix [limit]
+  // mem clusterID
+  // quota clusterID mb
+  // stale key max_staleness_ms
+  // watch prefix
+  // bench count [concurrency]
+  // indexbench count
+  // filterbench count
+  // applybench count
   auto timeout = dragonboat::Milliseconds(3000);
+  // one batcher per cluster, indexed by clusterID - ClusterID1
+  std::vector<std::unique_ptr<ProposalBatcher>> batchers;
+  if (batchOptions.maxBytes != 0) {
+    batchOptions.timeout = timeout;
+    for (auto clusterID : {ClusterID1, ClusterID2}) {
+      batchers.emplace_back(
+        new ProposalBatcher(nh.get(), clusterID, batchOptions));
+    }
+  }
+  std::unique_ptr<ReadCoordinator> reader;
+  if (readWindowMicros != 0) {
+    ReadCoordinatorOptions readOptions;
+    readOptions.windowMicros = readWindowMicros;
+    readOptions.timeout = timeout;
+    reader.reset(new ReadCoordinator(nh.get(), readOptions));
+  }
+  StaleReader staleReader(nh.get(), timeout, reader.get());
+  // the quota is part of the replicated state, the last quota proposed by any
+  // node applies to all replicas of a cluster
+  auto proposeQuota = [&nh, timeout](uint64_t clusterID, uint64_t bytes)
+  {
+    auto cmd = "quota " + std::to_string(bytes);
+    dragonboat::Buffer buf(
+      reinterpret_cast<const dragonboat::Byte *>(cmd.c_str()), cmd.size());
+    std::unique_ptr<dragonboat::Session> session(
+      nh->GetNoOPSession(clusterID));
+    dragonboat::UpdateResult ret;
+    return nh->SyncPropose(session.get(), buf, timeout, &ret);
+  };
+  if (memQuotaBytes != 0) {
+    for (auto clusterID : {ClusterID1, ClusterID2}) {
+      // retried while the cluster elects its leader
+      for (int i = 0; i < 10; ++i) {
+        status = proposeQuota(clusterID, memQuotaBytes);
+        if (status.OK()) {
+          break;
+        }
+      }
+      if (!status.OK()) {
+        std::cerr
+          << "failed to set the quota of cluster " << clusterID
+          << ": " << status.Code() << std::endl;
+      }
+    }
+  }
+  // advances the Raft-applied time bounding the staleness of stale reads
+  // while the cluster is read through staleReader, ticks from several nodes
+  // are harmless as the state machines keep the largest one
+  std::unique_ptr<Ticker> ticker(new Ticker(
+    nh.get(), {ClusterID1, ClusterID2}, tickMillis, timeout, &staleReader,
+    [&staleReader](uint64_t clusterID)
+    {
+      return staleReader.SinceLastRead(clusterID) < staleReadDemandMillis;
+    }));
+  std::atomic<bool> stopped(false);
+  // one consumer thread per subscription, printing the events pushed by
+  // update
+  std::vector<std::thread> watchers;
+  auto read = [&nh, &reader, timeout](
+    uint64_t clusterID,
+    const dragonboat::Buffer &query,
+    dragonboat::Buffer *result)
+  {
+    if (reader) {
+      return reader->Read(clusterID, query, result);
+    }
+    return nh->SyncRead(clusterID, query, result, timeout);
+  };
+  // prints the pages of query(cursor) until a page has no cursor, one page
+  // per read so that neither side holds the whole result
+  auto readPages = [&read](
+    uint64_t clusterID,
+    size_t pageBytes,
+    const std::function<std::string(const std::string &)> &query)
+  {
+    std::string cursor;
+    do {
+      auto q = query(cursor);
+      dragonboat::Buffer buf(
+        reinterpret_cast<const dragonboat::Byte *>(q.c_str()), q.size());
+      dragonboat::Buffer result(pageBytes);
+      auto status = read(clusterID, buf, &result);
+      if (!status.OK()) {
+        std::cerr << "error code: " << status.Code() << std::endl;
+        break;
+      }
+      std::string page(
+        reinterpret_cast<const char *>(result.Data()), result.Len());
+      auto pos = page.rfind("\nnext: ");
+      cursor = pos == std::string::npos ? "" : page.substr(pos + 7);
+      std::cout << page.substr(0, pos) << std::endl;
+    } while (!cursor.empty());
+  };
   for (std::string message; std::getline(std::cin, message);) {
     auto parts = split(message);
+    if (!parts.empty() && parts[0] == "watch") {
+      if (parts.size() != 2) {
+        std::cerr << "Usage: watch prefix" << std::endl;
+        continue;
+      }
+      // the keys with the prefix are spread over both clusters
+      for (uint64_t i = 0; i < 2; ++i) {
+        auto sub = watches[i]->Subscribe(parts[1], true);
+        auto hub = watches[i];
+        watchers.emplace_back([&stopped, hub, sub, i]()
+        {
+          WatchEvent event;
+          while (!stopped) {
+            if (sub->Wait(&event, std::chrono::milliseconds(100))) {
+              std::cout
+                << "watch cluster " << ClusterID1 + i << ": "
+                << formatWatchEvent(event) << std::endl;
+            }
+          }
+          hub->Unsubscribe(sub);
+        });
+      }
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "stale") {
+      if (parts.size() != 3) {
+        std::cerr << "Usage: stale key max_staleness_ms" << std::endl;
+        continue;
+      }
+      auto clusterID = std::hash<std::string>()(parts[1]) % 2 + ClusterID1;
+      dragonboat::Buffer query(
+        reinterpret_cast<const dragonboat::Byte *>(parts[1].c_str()),
+        parts[1].size());
+      dragonboat::Buffer result(1024);
+      bool local = false;
+      status = staleReader.Read(
+        clusterID, query, &result, std::stoull(parts[2]), &local);
+      if (status.OK()) {
+        std::cout
+          << std::string(
+            reinterpret_cast<const char *>(result.Data()), result.Len())
+          << (local ? "" : " (linearizable)") << std::endl;
+      } else {
+        std::cerr << "error code: " << status.Code() << std::endl;
+      }
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "bench") {
+      if (parts.size() < 2 || parts.size() > 3) {
+        std::cerr << "Usage: bench count [concurrency]" << std::endl;
+        continue;
+      }
+      runBench(
+        nh.get(), batchers, std::stoull(parts[1]),
+        parts.size() > 2 ? std::stoull(parts[2]) : 16, timeout);
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "indexbench") {
+      if (parts.size() != 2) {
+        std::cerr << "Usage: indexbench count" << std::endl;
+        continue;
+      }
+      runIndexBench(std::stoull(parts[1]));
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "applybench") {
+      if (parts.size() != 2) {
+        std::cerr << "Usage: applybench count" << std::endl;
+        continue;
+      }
+      runApplyBench(std::stoull(parts[1]));
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "filterbench") {
+      if (parts.size() != 2) {
+        std::cerr << "Usage: filterbench count" << std::endl;
+        continue;
+      }
+      runFilterBench(std::stoull(parts[1]),
+        options.bloomBitsPerKey != 0 ? options.bloomBitsPerKey : 10);
+      continue;
+    }
+    if (!parts.empty() && (parts[0] == "scan" || parts[0] == "prefix")) {
+      if (parts.size() < 3 || parts.size() > (parts[0] == "scan" ? 5 : 4)) {
+        std::cerr
+          << "Usage: scan clusterID begin [end [limit]], "
+          << "prefix clusterID prefix [limit]" << std::endl;
+        continue;
+      }
+      auto clusterID = std::stoull(parts[1]);
+      // missing end and limit are sent empty so that the cursor always has
+      // the same position
+      auto args = std::vector<std::string>(parts.begin() + 2, parts.end());
+      args.resize(parts[0] == "scan" ? 3 : 2);
+      std::string q = parts[0];
+      for (auto &arg : args) {
+        q.append(" ").append(arg);
+      }
+      readPages(
+        clusterID, defaultPageBytes,
+        [&q](const std::string &cursor) { return q + " " + cursor; });
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "display") {
+      if (parts.size() < 2 || parts.size() > 3) {
+        std::cerr << "Usage: display clusterID [page_kb]" << std::endl;
+        continue;
+      }
+      auto clusterID = std::stoull(parts[1]);
+      size_t pageBytes = defaultPageBytes;
+      if (parts.size() > 2) {
+        pageBytes = std::max<size_t>(
+          std::stoull(parts[2]) * 1024, minPageBytes);
+      }
+      readPages(
+        clusterID, pageBytes,
+        [pageBytes](const std::string &cursor)
+        {
+          std::string q = "display " + std::to_string(pageBytes);
+          if (!cursor.empty()) {
+            q.append(" ").append(cursor);
+          }
+          return q;
+        });
+      continue;
+    }
+    if (!parts.empty() && parts[0] == "quota") {
+      if (parts.size() != 3) {
+        std::cerr << "Usage: quota clusterID mb" << std::endl;
+        continue;
+      }
+      status = proposeQuota(
+        std::stoull(parts[1]), std::stoull(parts[2]) * 1024 * 1024);
+      if (!status.OK()) {
+        std::cerr << "error code: " << status.Code() << std::endl;
+      }
+      continue;
+    }
     if (parts.size() < 1 || parts.size() > 3) {
       std::cerr << "undefined command: " << message << std::endl;
       continue;
@@ -106,8 +462,8 @@ int main(int argc, char **argv, char **env)
       std::cerr << "Usage: set key value" << std::endl;
       continue;
     }
-    if (parts.size() == 2 && parts[0] != "display") {
-      std::cerr << "Usage: display clusterID" << std::endl;
+    if (parts.size() == 2 && parts[0] != "mem") {
+      std::cerr << "Usage: display clusterID [page_kb]" << std::endl;
       continue;
     }
     if (parts[0] == "exit") {
@@ -120,15 +476,15 @@ int main(int argc, char **argv, char **env)
         dragonboat::Buffer query(
           reinterpret_cast<const dragonboat::Byte *>(parts[0].c_str()),
           parts[0].size());
-        status = nh->SyncRead(clusterID, query, &result, timeout);
+        status = read(clusterID, query, &result);
         break;
       }
       case 2: {
-        auto clusterID = std::stoi(parts[1]);
+        auto clusterID = std::stoull(parts[1]);
         dragonboat::Buffer query(
-          reinterpret_cast<const dragonboat::Byte *>(parts[0].c_str()),
-          parts[0].size());
-        status = nh->SyncRead(clusterID, query, &result, timeout);
+          reinterpret_cast<const dragonboat::Byte *>(memQuery.c_str()),
+          memQuery.size());
+        status = read(clusterID, query, &result);
         break;
       }
       case 3: {
@@ -136,19 +492,35 @@ int main(int argc, char **argv, char **env)
         dragonboat::Buffer query(
           reinterpret_cast<const dragonboat::Byte *>(message.c_str()),
           message.size());
-        std::unique_ptr<dragonboat::Session> session(
-          nh->GetNoOPSession(clusterID));
         dragonboat::UpdateResult ret;
-        status = nh->SyncPropose(session.get(), query, timeout, &ret);
+        if (!batchers.empty()) {
+          status = batchers[clusterID - ClusterID1]->Propose(message, &ret);
+        } else {
+          std::unique_ptr<dragonboat::Session> session(
+            nh->GetNoOPSession(clusterID));
+          status = nh->SyncPropose(session.get(), query, timeout, &ret);
+        }
+        if (status.OK() && ret == 0) {
+          std::cerr << "rejected, memory quota exceeded" << std::endl;
+        }
         break;
       }
       default:std::cerr << "error" << std::endl;
     }
     if (status.OK() && result.Len() != 0) {
-      std::cout << result.Data() << std::endl;
+      std::cout
+        << std::string(
+          reinterpret_cast<const char *>(result.Data()), result.Len())
+        << std::endl;
     } else if (!status.OK()) {
       std::cerr << "error code: " << status.Code() << std::endl;
     }
   }
+  stopped = true;
+  ticker.reset();
+  for (auto &watcher : watchers) {
+    watcher.join();
+  }
+  batchers.clear();
   nh->Stop();
 }
\ No newline at end of file
@@ -16,145 +16,383 @@
 #include <cstring>
 #include <sstream>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
 #include <algorithm>
 #include "statemachines.h"
 #include "utils.h"
 
-void KVStoreStateMachine::update(dragonboat::Entry &ent) noexcept
+const CommandTable<KVStoreStateMachine> &KVStoreStateMachine::commands()
 {
-  std::string query(reinterpret_cast<const char *>(ent.cmd), ent.cmdLen);
-  auto parts = split(query);
-  if (parts[0] == "set") {
-    kvstore_[parts[1]] = parts[2];
-  } else if (parts[0] == "del") {
-    kvstore_.erase(parts[1]);
-  } else if (parts[0] == "clr") {
-    kvstore_.clear();
-  } else {
-    ent.result = update_count_;
+  static const CommandTable<KVStoreStateMachine> table{
+    {"set", 2, 2, &KVStoreStateMachine::set},
+    {"del", 1, 1, &KVStoreStateMachine::del},
+    {"clr", 0, 0, &KVStoreStateMachine::clr},
+    {"quota", 1, 1, &KVStoreStateMachine::quota},
+    {"tick", 1, 1, &KVStoreStateMachine::tick},
+  };
+  return table;
+}
+
+uint64_t KVStoreStateMachine::set(const CommandArgs &args)
+{
+  auto key = args[1].ToString();
+  auto value = args[2].ToString();
+  if (isReservedKey(key)) {
+    return 0;
+  }
+  if (memQuota_ != 0) {
+    // an overwrite only grows the data by the difference to the old pair
+    size_t existing = 0;
+    StringRef old;
+    if (kvstore_->Get(key, &old)) {
+      existing = key.size() + old.size;
+    }
+    auto bytes = key.size() + value.size();
+    if (bytes > existing
+      && kvstore_->DataBytes() - existing + bytes > memQuota_) {
+      return 0;
+    }
+  }
+  kvstore_->Put(key, value);
+  publish(args.Index(), WATCH_PUT, key, value);
+  if (filter_) {
+    filter_->Add(key.data(), key.size());
+    if (filter_->Saturated()) {
+      rebuildFilter();
+    }
   }
   update_count_++;
-  ent.result = update_count_;
+  return 1;
 }
 
-LookupResult KVStoreStateMachine::lookup(
-  const dragonboat::Byte *data,
-  size_t size) const noexcept
+uint64_t KVStoreStateMachine::del(const CommandArgs &args)
 {
-  LookupResult r;
-  std::string query(reinterpret_cast<const char *>(data), size);
-  std::string result;
-  if (query == "display") {
+  auto key = args[1].ToString();
+  kvstore_->Erase(key);
+  publish(args.Index(), WATCH_DELETE, key, std::string());
+  update_count_++;
+  return 1;
+}
+
+uint64_t KVStoreStateMachine::clr(const CommandArgs &args)
+{
+  kvstore_->Clear();
+  rebuildFilter();
+  publish(args.Index(), WATCH_DELETE_RANGE, std::string(), std::string());
+  update_count_++;
+  return 1;
+}
+
+uint64_t KVStoreStateMachine::quota(const CommandArgs &args)
+{
+  uint64_t bytes;
+  if (!args.Uint64(1, &bytes)) {
+    return 0;
+  }
+  memQuota_ = bytes;
+  update_count_++;
+  return 1;
+}
+
+uint64_t KVStoreStateMachine::tick(const CommandArgs &args)
+{
+  uint64_t millis;
+  if (!args.Uint64(1, &millis)) {
+    return 0;
+  }
+  appliedTime_ = std::max(appliedTime_, millis);
+  update_count_++;
+  return 1;
+}
+
+void KVStoreStateMachine::applied(uint64_t index)
+{
+  appliedIndex_ = index;
+  kvstore_->MaybeCompact(compactGarbageBytes);
+}
+
+void KVStoreStateMachine::publish(
+  uint64_t index,
+  WatchEventType type,
+  const std::string &key,
+  const std::string &value)
+{
+  if (options_.watch && options_.watch->Active()) {
+    options_.watch->Publish({index, type, key, value});
+  }
+}
+
+// the result of all misses
+static const char notFound[] = "not found";
+
+void KVStoreStateMachine::rebuildFilter()
+{
+  if (options_.bloomBitsPerKey == 0) {
+    return;
+  }
+  filter_.reset(new BlockedBloomFilter(
+    std::max(kvstore_->Size() * 2, minBloomKeys), options_.bloomBitsPerKey));
+  kvstore_->ForEach(
+    [this](const StringRef &key, const StringRef &)
+    {
+      filter_->Add(key.data, key.size);
+      return true;
+    });
+}
+
+void KVStoreStateMachine::query(
+  const StringRef &ref,
+  std::string *result) const
+{
+  auto query = ref.ToString();
+  auto parts = split(query);
+  if (query == memQuery) {
     std::stringstream ss;
-    ss << "{ ";
-    std::for_each(
-      kvstore_.cbegin(),
-      kvstore_.cend(),
-      [&ss](const std::pair<const std::string, std::string> &item)
-      {
-        ss << "\"" << item.first << "\":\"" << item.second << "\", ";
-      });
-    ss << "}";
-    auto str = ss.str();
-    r.result = new char[str.size()];
-    r.size = str.size();
-    std::memcpy(r.result, str.data(), r.size);
-    return r;
-  }
-  auto it = kvstore_.find(query);
-  if (it == kvstore_.end()) {
-    char nf[] = "not found";
-    r.result = new char[sizeof(nf)];
-    r.size = sizeof(nf);
-    std::memcpy(r.result, nf, r.size);
+    ss << kvstore_->Memory().ToString() << "\n"
+       << "quota_bytes: " << memQuota_ << "\n"
+       << "bloom_bytes: " << (filter_ ? filter_->MemoryBytes() : 0) << "\n"
+       << "bloom_negatives: " << bloomNegatives_.load();
+    result->assign(ss.str());
+    return;
+  }
+  if (query == appliedQuery) {
+    result->assign(encodeAppliedState({appliedIndex_, appliedTime_}));
+    return;
+  }
+  if ((parts[0] == "display" && parts.size() <= 3)
+    || (parts.size() >= 2 && parts.size() <= 5 && parts[0] == "scan")
+    || (parts.size() >= 2 && parts.size() <= 4 && parts[0] == "prefix")) {
+    // display [page_bytes [cursor]], scan begin [end [limit [cursor]]],
+    // prefix prefix [limit [cursor]], an empty end or limit is no bound
+    std::string begin;
+    std::string end;
+    size_t limit = SIZE_MAX;
+    size_t pageBytes = defaultPageBytes;
+    if (parts[0] == "display") {
+      if (parts.size() > 1) {
+        pageBytes = std::max<size_t>(
+          std::strtoull(parts[1].c_str(), nullptr, 10), minPageBytes);
+      }
+      // the cursor is the last key of the previous page
+      if (parts.size() > 2 && decodeCursor(parts[2], &begin, &limit)) {
+        begin.push_back('\0');
+      }
+    } else {
+      begin = parts[1];
+      if (parts[0] == "scan") {
+        end = parts.size() > 2 ? parts[2] : "";
+      } else {
+        end = PrefixEnd(begin);
+      }
+      size_t limitArg = parts[0] == "scan" ? 3 : 2;
+      if (parts.size() > limitArg && !parts[limitArg].empty()) {
+        limit = std::strtoull(parts[limitArg].c_str(), nullptr, 10);
+      }
+      // the cursor also carries the limit left after the previous pages
+      std::string last;
+      if (parts.size() > limitArg + 1
+        && decodeCursor(parts[limitArg + 1], &last, &limit)) {
+        begin = std::max(begin, last + std::string(1, '\0'));
+      }
+    }
+    page(begin, end, limit, pageBytes, result);
+    return;
+  }
+  StringRef val;
+  if (filter_ && !filter_->MayContain(query.data(), query.size())) {
+    bloomNegatives_++;
+    result->assign(notFound, sizeof(notFound));
+  } else if (!kvstore_->Get(query, &val)) {
+    result->assign(notFound, sizeof(notFound));
   } else {
-    r.result = new char[it->second.size()];
-    r.size = it->second.size();
-    std::memcpy(r.result, it->second.data(), r.size);
+    result->assign(val.data, val.size);
   }
-  return r;
 }
 
-uint64_t KVStoreStateMachine::getHash() const noexcept
+// { "key":"value", ... }, followed by \nnext: cursor if the page is full
+static size_t entryBytes(const StringRef &key, const StringRef &val)
 {
-  return static_cast<uint64_t>(update_count_);
+  return key.size + val.size + 7;
 }
 
-SnapshotResult KVStoreStateMachine::saveSnapshot(
-  dragonboat::SnapshotWriter *writer,
-  dragonboat::SnapshotFileCollection *collection,
-  const dragonboat::DoneChan &done) const noexcept
+static const char hexDigits[] = "0123456789abcdef";
+
+bool decodeCursor(
+  const std::string &cursor,
+  std::string *key,
+  size_t *remaining)
 {
-  SnapshotResult r;
-  dragonboat::IOResult ret;
-  r.errcode = SNAPSHOT_OK;
-  r.size = 0;
-  std::string ss;
-  ss.append(std::to_string(update_count_)).append("\n");
-  std::for_each(
-    kvstore_.cbegin(),
-    kvstore_.cend(),
-    [&ss](const std::pair<const std::string, std::string> &kv)
+  if (cursor.empty()) {
+    return false;
+  }
+  auto hexEnd = std::min(cursor.find(','), cursor.size());
+  if (hexEnd % 2 != 0) {
+    return false;
+  }
+  if (hexEnd < cursor.size()) {
+    char *end = nullptr;
+    auto n = std::strtoull(cursor.c_str() + hexEnd + 1, &end, 10);
+    if (hexEnd + 1 == cursor.size() || *end != '\0') {
+      return false;
+    }
+    *remaining = n;
+  }
+  key->clear();
+  for (size_t i = 0; i < hexEnd; i += 2) {
+    auto hi = std::strchr(hexDigits, cursor[i]);
+    auto lo = std::strchr(hexDigits, cursor[i + 1]);
+    if (hi == nullptr || lo == nullptr || *hi == '\0' || *lo == '\0') {
+      return false;
+    }
+    key->push_back(static_cast<char>((hi - hexDigits) << 4 | (lo - hexDigits)));
+  }
+  return true;
+}
+
+void KVStoreStateMachine::page(
+  const std::string &begin,
+  const std::string &end,
+  size_t limit,
+  size_t pageBytes,
+  std::string *result) const
+{
+  static const char header[] = "{ ";
+  static const char footer[] = "}";
+  static const char next[] = "\nnext: ";
+  // the entries are only referenced until the page size is known so that
+  // the result is reserved once
+  std::vector<std::pair<StringRef, StringRef>> entries;
+  size_t size = sizeof(header) - 1 + sizeof(footer) - 1;
+  bool full = false;
+  // a limited cursor ends with ",remaining"
+  size_t remainingBytes = limit == SIZE_MAX ? 0 : 21;
+  // every entry takes at least entryBytes of empty strings, so a page never
+  // needs more than the visits below, the last one tells if it is full
+  auto maxVisits = std::min(limit, pageBytes / entryBytes({}, {})) + 1;
+  kvstore_->Scan(
+    begin, end, maxVisits,
+    [&](const StringRef &key, const StringRef &val)
     {
-      ss.append(kv.first).append(" ").append(kv.second).append("\n");
+      if (entries.size() == limit) {
+        return false;
+      }
+      auto bytes = entryBytes(key, val);
+      // leaves room for the cursor of the page ending with this entry, a
+      // pair larger than a page gets a page of its own
+      if (!entries.empty()
+        && size + bytes + sizeof(next) - 1 + 2 * key.size + remainingBytes
+          > pageBytes) {
+        full = true;
+        return false;
+      }
+      entries.emplace_back(key, val);
+      size += bytes;
+      return true;
     });
-  if (done.Closed()) {
-    r.errcode = SNAPSHOT_STOPPED;
-    return r;
-  } else {
-    ret = writer->Write(
-      reinterpret_cast<const dragonboat::Byte *>(ss.data()),
-      ss.size());
-    if (ret.size != ss.size()) {
-      r.errcode = FAILED_TO_SAVE_SNAPSHOT;
-      return r;
+  std::string remaining;
+  if (full && limit != SIZE_MAX) {
+    remaining = "," + std::to_string(limit - entries.size());
+  }
+  if (full) {
+    size += sizeof(next) - 1 + 2 * entries.back().first.size + remaining.size();
+  }
+  result->clear();
+  result->reserve(size);
+  result->append(header, sizeof(header) - 1);
+  for (auto &entry : entries) {
+    result->push_back('"');
+    result->append(entry.first.data, entry.first.size);
+    result->append("\":\"", 3);
+    result->append(entry.second.data, entry.second.size);
+    result->append("\", ", 3);
+  }
+  result->append(footer, sizeof(footer) - 1);
+  if (full) {
+    result->append(next, sizeof(next) - 1);
+    auto &last = entries.back().first;
+    for (size_t i = 0; i < last.size; ++i) {
+      result->push_back(
+        hexDigits[static_cast<unsigned char>(last.data[i]) >> 4]);
+      result->push_back(
+        hexDigits[static_cast<unsigned char>(last.data[i]) & 0xf]);
     }
+    result->append(remaining);
   }
-  r.size = ss.size();
-  return r;
+  assert(result->size() == size);
+}
+
+uint64_t KVStoreStateMachine::hash() const
+{
+  return static_cast<uint64_t>(update_count_);
+}
+
+bool KVStoreStateMachine::save(SnapshotStreamWriter *stream) const
+{
+  // snapshots without the state line start with the update count
+  std::string ss;
+  ss.append("state ").append(std::to_string(update_count_))
+    .append(" ").append(std::to_string(memQuota_))
+    .append(" ").append(std::to_string(appliedIndex_))
+    .append(" ").append(std::to_string(appliedTime_)).append("\n");
+  kvstore_->ForEach(
+    [&ss](const StringRef &key, const StringRef &val)
+    {
+      ss.append(key.data, key.size).append(" ")
+        .append(val.data, val.size).append("\n");
+      return true;
+    });
+  return stream->Write(ss.data(), ss.size());
 }
 
-int KVStoreStateMachine::recoverFromSnapshot(
-  dragonboat::SnapshotReader *reader,
-  const std::vector<dragonboat::SnapshotFile> &files,
-  const dragonboat::DoneChan &done) noexcept
+bool KVStoreStateMachine::recover(SnapshotStreamReader *stream)
 {
-  assert(kvstore_.empty());
+  assert(kvstore_->Size() == 0);
   assert(update_count_ == 0);
   constexpr size_t BUF_SIZE = 4096;
-  dragonboat::IOResult ret;
-  dragonboat::Byte data[BUF_SIZE];
+  int64_t ret;
+  char data[BUF_SIZE];
   std::stringstream ss;
   while (true) {
-    ret = reader->Read(data, BUF_SIZE);
-    if (ret.size <= 0) {
+    ret = stream->Read(data, BUF_SIZE);
+    if (ret <= 0) {
       break;
     }
-    ss.write(reinterpret_cast<const char *>(data), ret.size);
+    ss.write(data, ret);
   }
-  if (ret.size < 0) {
-    return FAILED_TO_RECOVER_FROM_SNAPSHOT;
-  } else if (ret.size == 0) {
-    std::string count;
-    ss >> count;
-    update_count_ = std::stoi(count);
-    std::string key;
-    std::string val;
-    while (ss >> key >> val) {
-      kvstore_[key] = val;
+  if (ret < 0) {
+    return false;
+  }
+  std::string count;
+  ss >> count;
+  if (count == "state") {
+    // the applied index and time were added to the state line later
+    std::string line;
+    std::getline(ss, line);
+    std::istringstream state(line);
+    state >> update_count_ >> memQuota_;
+    if (!(state >> appliedIndex_ >> appliedTime_)) {
+      appliedIndex_ = 0;
+      appliedTime_ = 0;
     }
+  } else {
+    update_count_ = std::stoi(count);
   }
-  return SNAPSHOT_OK;
-}
-
-void KVStoreStateMachine::freeLookupResult(LookupResult r) noexcept
-{
-  delete[] r.result;
+  std::string key;
+  std::string val;
+  while (ss >> key >> val) {
+    kvstore_->Put(key, val);
+  }
+  rebuildFilter();
+  // the watchers cannot tell which keys the snapshot changed
+  publish(appliedIndex_, WATCH_RESYNC, "", "");
+  return true;
 }
 
 dragonboat::RegularStateMachine *createDragonboatStateMachine(
   uint64_t clusterID,
-  uint64_t nodeID)
+  uint64_t nodeID,
+  const KVStoreOptions &options)
 {
-  return new KVStoreStateMachine(clusterID, nodeID);
+  return new KVStoreStateMachine(clusterID, nodeID, options);
 }
\ No newline at end of file
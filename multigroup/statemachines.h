@@ -15,39 +15,124 @@
 #ifndef DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_STATEMACHINES_H_
 #define DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_STATEMACHINES_H_
 
-#include "dragonboat/statemachine/regular.h"
 #include <vector>
-#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include "statemachinebase.h"
+#include "snapshotstream.h"
+#include "kvindex.h"
+#include "bloomfilter.h"
+#include "proposalbatcher.h"
+#include "stalereader.h"
+#include "watchhub.h"
+#include "utils.h"
 
-class KVStoreStateMachine : public dragonboat::RegularStateMachine {
+// answered with the memory used by the cluster
+const std::string memQuery = taggedQuery("mem");
+
+// results of display, scan and prefix lookups are split into pages of at
+// most page bytes, a full page ends with the cursor of the next one
+constexpr size_t defaultPageBytes = 64 * 1024;
+constexpr size_t minPageBytes = 4 * 1024;
+
+// the arena of a KV store is compacted once its garbage exceeds both its live
+// bytes and compactGarbageBytes
+constexpr size_t compactGarbageBytes = 1024 * 1024;
+
+// the result of each command in a batch entry is 1 if it was applied and 0
+// if it was rejected
+constexpr size_t batchResultBits = 1;
+
+// decodes the hex encoded key of a cursor and, if the cursor has one, the
+// limit left for the next pages
+bool decodeCursor(
+  const std::string &cursor,
+  std::string *key,
+  size_t *remaining);
+
+struct KVStoreOptions {
+  SnapshotCodec codec = CODEC_NONE;
+  IndexType index = INDEX_HASH;
+  // bits per key of the filter answering misses without probing the index,
+  // 0 to disable it
+  size_t bloomBitsPerKey = 0;
+  // receives the changes applied by update, nullptr for none, a hub can only
+  // be used by one state machine
+  std::shared_ptr<WatchHub> watch;
+};
+
+// the filter is rebuilt from the index once it is saturated, sized for twice
+// the keys and at least minBloomKeys
+constexpr size_t minBloomKeys = 1024;
+
+// the commands are "set key value", "del key", "clr", "quota bytes" and
+// "tick unix_ms", each returns 0 if it was rejected
+class KVStoreStateMachine
+  : public RegularStateMachineBase<KVStoreStateMachine> {
  public:
-  KVStoreStateMachine(uint64_t clusterID, uint64_t nodeID) noexcept
-    : RegularStateMachine(clusterID, nodeID), update_count_(0), kvstore_()
-  {}
+  KVStoreStateMachine(
+    uint64_t clusterID,
+    uint64_t nodeID,
+    const KVStoreOptions &options = KVStoreOptions()) noexcept
+    : RegularStateMachineBase(clusterID, nodeID, options.codec),
+      update_count_(0), memQuota_(0), appliedIndex_(0), appliedTime_(0),
+      kvstore_(NewKVIndex(options.index)), options_(options),
+      bloomNegatives_(0)
+  {
+    rebuildFilter();
+  }
   ~KVStoreStateMachine() noexcept override = default;
- protected:
-  void update(dragonboat::Entry &ent) noexcept override;
-  LookupResult lookup(
-    const dragonboat::Byte *data,
-    size_t size) const noexcept override;
-  uint64_t getHash() const noexcept override;
-  SnapshotResult saveSnapshot(
-    dragonboat::SnapshotWriter *writer,
-    dragonboat::SnapshotFileCollection *collection,
-    const dragonboat::DoneChan &done) const noexcept override;
-  int recoverFromSnapshot(
-    dragonboat::SnapshotReader *reader,
-    const std::vector<dragonboat::SnapshotFile> &files,
-    const dragonboat::DoneChan &done) noexcept override;
-  void freeLookupResult(LookupResult r) noexcept override;
  private:
+  friend class RegularStateMachineBase<KVStoreStateMachine>;
   DISALLOW_COPY_MOVE_AND_ASSIGN(KVStoreStateMachine);
+  static const CommandTable<KVStoreStateMachine> &commands();
+  uint64_t set(const CommandArgs &args);
+  uint64_t del(const CommandArgs &args);
+  uint64_t clr(const CommandArgs &args);
+  uint64_t quota(const CommandArgs &args);
+  uint64_t tick(const CommandArgs &args);
+  void applied(uint64_t index);
+  void query(const StringRef &query, std::string *result) const;
+  uint64_t hash() const;
+  bool save(SnapshotStreamWriter *stream) const;
+  bool recover(SnapshotStreamReader *stream);
+  void rebuildFilter();
+  void publish(
+    uint64_t index,
+    WatchEventType type,
+    const std::string &key,
+    const std::string &value);
+  // serializes the pairs in [begin, end) into result
+  void page(
+    const std::string &begin,
+    const std::string &end,
+    size_t limit,
+    size_t pageBytes,
+    std::string *result) const;
   int update_count_;
-  std::unordered_map<std::string, std::string> kvstore_;
+  // limit of the key and value bytes set by "quota bytes" commands, 0 for no
+  // limit, sets exceeding it are rejected with result 0, it is part of the
+  // snapshot so that all replicas reject the same sets
+  uint64_t memQuota_;
+  // answered to appliedQuery, the applied time is advanced by "tick ms"
+  // commands, both are part of the snapshot so that a recovered node can
+  // serve stale reads before the next tick
+  uint64_t appliedIndex_;
+  uint64_t appliedTime_;
+  std::unique_ptr<KVIndex> kvstore_;
+  const KVStoreOptions options_;
+  // keys deleted from the index are only dropped from the filter when it is
+  // rebuilt
+  std::unique_ptr<BlockedBloomFilter> filter_;
+  mutable std::atomic<uint64_t> bloomNegatives_;
 };
 
+static_assert(KVStoreStateMachine::resultBits == batchResultBits,
+  "the batchers must unpack the results the state machine packs");
+
 dragonboat::RegularStateMachine *createDragonboatStateMachine(
   uint64_t clusterID,
-  uint64_t nodeID);
+  uint64_t nodeID,
+  const KVStoreOptions &options);
 
 #endif //DRAGONBOAT_CPP_EXAMPLE_MULTIGROUP_STATEMACHINES_H_
@@ -0,0 +1,321 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "applybatch.h"
+#include "mergeoperator.h"
+#include "statemachine.h"
+#include "value.h"
+
+// sorted
+static const std::string *const internalKeys[] = {
+  &appliedIndexKey,
+  &appliedTimeKey,
+  &ttlInUseKey,
+};
+
+static bool isInternalKey(const std::string &key)
+{
+  for (auto internal : internalKeys) {
+    if (key == *internal) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool hasInternalKey(const Command &cmd)
+{
+  for (auto &cond : cmd.conditions) {
+    if (isInternalKey(cond.key)) {
+      return true;
+    }
+  }
+  for (auto &mut : cmd.mutations) {
+    if (mut.type != MUT_DELETE_RANGE && isInternalKey(mut.key)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isMerge(const Mutation &mut)
+{
+  return mut.type == MUT_INCR || mut.type == MUT_APPEND
+    || mut.type == MUT_MAX;
+}
+
+ApplyBatch::ApplyBatch(RocksDB *rocks, uint64_t appliedTime, bool ttlInUse)
+  : rocks_(rocks), appliedIndex_(0), written_(0),
+    appliedTime_(appliedTime), timeChanged_(false),
+    ttlInUse_(ttlInUse), ttlChanged_(false), stamped_(0)
+{
+}
+
+rocksdb::Status ApplyBatch::Apply(const Command &cmd, CommandStatus *status)
+{
+  if (cmd.tick != 0) {
+    if (cmd.tick > appliedTime_) {
+      appliedTime_ = cmd.tick;
+      timeChanged_ = true;
+    }
+    *status = STATUS_OK;
+    return rocksdb::Status::OK();
+  }
+  if (hasInternalKey(cmd)) {
+    *status = STATUS_INVALID_COMMAND;
+    return rocksdb::Status::OK();
+  }
+  std::string value;
+  bool found = false;
+  for (auto &cond : cmd.conditions) {
+    auto s = get(cond.key, &value, &found);
+    if (!s.ok()) {
+      return s;
+    }
+    bool hold = cond.type == COND_ABSENT ?
+      !found : (found && value == cond.value);
+    if (!hold) {
+      *status = STATUS_CONDITION_FAILED;
+      return rocksdb::Status::OK();
+    }
+  }
+  // a merge becomes a read-modify-write once a put makes TTL in use, and
+  // resolving the pending operands of its key writes wb_, so the keys are
+  // resolved before the first mutation of cmd is added to wb_ and such a
+  // write only ever holds complete entries
+  for (auto &mut : cmd.mutations) {
+    if (isMerge(mut) && merged_.count(mut.key) != 0) {
+      Cached *entry = nullptr;
+      auto s = load(mut.key, &entry);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+  }
+  for (auto &mut : cmd.mutations) {
+    rocksdb::Status s;
+    switch (mut.type) {
+      case MUT_PUT:put(mut.key, mut.value, mut.ttl);
+        break;
+      case MUT_DELETE:remove(mut.key);
+        break;
+      case MUT_DELETE_RANGE:removeRange(mut.key, mut.value);
+        break;
+      default:s = merge(mut.key, encodeMergeOperand(mut));
+        break;
+    }
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  *status = STATUS_OK;
+  return rocksdb::Status::OK();
+}
+
+void ApplyBatch::SetAppliedIndex(uint64_t index) noexcept
+{
+  appliedIndex_ = index;
+  for (; stamped_ < changes_.size(); ++stamped_) {
+    changes_[stamped_].index = index;
+  }
+}
+
+rocksdb::Status ApplyBatch::Write(const rocksdb::WriteOptions &wo)
+{
+  wb_.Put(rocks_->cf_, appliedIndexKey, std::to_string(appliedIndex_));
+  if (timeChanged_) {
+    wb_.Put(rocks_->cf_, appliedTimeKey, std::to_string(appliedTime_));
+    timeChanged_ = false;
+  }
+  if (ttlChanged_) {
+    wb_.Put(rocks_->cf_, ttlInUseKey, "1");
+    ttlChanged_ = false;
+  }
+  auto s = rocks_->db_->Write(wo, &wb_);
+  written_ += wb_.GetDataSize();
+  wb_.Clear();
+  merged_.clear();
+  removed_.clear();
+  return s;
+}
+
+uint64_t ApplyBatch::Bytes() const noexcept
+{
+  return written_ + wb_.GetDataSize();
+}
+
+uint64_t ApplyBatch::AppliedTime() const noexcept
+{
+  return appliedTime_;
+}
+
+bool ApplyBatch::TTLInUse() const noexcept
+{
+  return ttlInUse_;
+}
+
+const std::vector<KeyChange> &ApplyBatch::Changes() const noexcept
+{
+  return changes_;
+}
+
+rocksdb::Status ApplyBatch::load(const std::string &key, Cached **entry)
+{
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    *entry = &it->second;
+    return rocksdb::Status::OK();
+  }
+  if (merged_.count(key) != 0) {
+    // let RocksDB resolve the pending operands, Apply resolves the merged
+    // keys of a command before adding its mutations, so the entries applied
+    // so far are complete and safe to persist with their applied index
+    auto wo = rocks_->wo_;
+    wo.sync = false;
+    auto s = Write(wo);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  for (auto &range : removed_) {
+    if (key >= range.first && key < range.second) {
+      *entry = &(cache_[key] = {false, std::string(), 0});
+      return rocksdb::Status::OK();
+    }
+  }
+  std::string stored;
+  auto s = rocks_->db_->Get(rocks_->ro_, rocks_->cf_, key, &stored);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
+  }
+  Cached cached{s.ok(), std::string(), 0};
+  if (cached.found) {
+    rocksdb::Slice value;
+    if (!decodeValue(stored, &value, &cached.expiry)) {
+      return rocksdb::Status::Corruption("invalid value header", key);
+    }
+    cached.value = value.ToString();
+  }
+  *entry = &(cache_[key] = std::move(cached));
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status ApplyBatch::get(
+  const std::string &key,
+  std::string *value,
+  bool *found)
+{
+  Cached *entry = nullptr;
+  auto s = load(key, &entry);
+  if (!s.ok()) {
+    return s;
+  }
+  *found = entry->found && !isExpired(entry->expiry, appliedTime_);
+  if (*found) {
+    *value = entry->value;
+  } else {
+    value->clear();
+  }
+  return rocksdb::Status::OK();
+}
+
+void ApplyBatch::put(
+  const std::string &key,
+  const std::string &value,
+  uint64_t ttl)
+{
+  uint64_t expiry = ttl == 0 ? 0 : appliedTime_ + ttl;
+  if (expiry != 0 && !ttlInUse_) {
+    ttlInUse_ = true;
+    ttlChanged_ = true;
+  }
+  wb_.Put(rocks_->cf_, key, encodeValue(value, expiry));
+  cache_[key] = {true, value, expiry};
+  changes_.push_back({0, CHANGE_PUT, key, value});
+}
+
+void ApplyBatch::remove(const std::string &key)
+{
+  wb_.Delete(rocks_->cf_, key);
+  cache_[key] = {false, std::string(), 0};
+  changes_.push_back({0, CHANGE_DELETE, key, std::string()});
+}
+
+void ApplyBatch::removeRange(
+  const std::string &begin,
+  const std::string &end)
+{
+  // one tombstone regardless of the number of keys in the range, split
+  // around the internal keys so that the applied state survives
+  auto from = begin;
+  for (auto internal : internalKeys) {
+    if (*internal < from || *internal >= end) {
+      continue;
+    }
+    if (from < *internal) {
+      wb_.DeleteRange(rocks_->cf_, from, *internal);
+    }
+    from = *internal + '\0';
+  }
+  if (from < end) {
+    wb_.DeleteRange(rocks_->cf_, from, end);
+  }
+  for (auto &cached : cache_) {
+    if (cached.first >= begin && cached.first < end) {
+      cached.second = {false, std::string(), 0};
+    }
+  }
+  for (auto it = merged_.begin(); it != merged_.end();) {
+    if (*it >= begin && *it < end) {
+      it = merged_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  removed_.emplace_back(begin, end);
+  changes_.push_back({0, CHANGE_DELETE_RANGE, begin, end});
+}
+
+rocksdb::Status ApplyBatch::merge(
+  const std::string &key,
+  const std::string &operand)
+{
+  if (ttlInUse_) {
+    Cached *entry = nullptr;
+    auto s = load(key, &entry);
+    if (!s.ok()) {
+      return s;
+    }
+    if (!entry->found || isExpired(entry->expiry, appliedTime_)) {
+      *entry = {true, std::string(), 0};
+    }
+    applyMergeOperand(&entry->value, operand);
+    wb_.Put(rocks_->cf_, key, encodeValue(entry->value, entry->expiry));
+    changes_.push_back({0, CHANGE_PUT, key, entry->value});
+    return rocksdb::Status::OK();
+  }
+  wb_.Merge(rocks_->cf_, key, operand);
+  auto it = cache_.find(key);
+  if (it == cache_.end()) {
+    merged_.insert(key);
+    changes_.push_back({0, CHANGE_MERGE, key, describeMergeOperand(operand)});
+    return rocksdb::Status::OK();
+  }
+  if (!it->second.found) {
+    it->second = {true, std::string(), 0};
+  }
+  applyMergeOperand(&it->second.value, operand);
+  changes_.push_back({0, CHANGE_PUT, key, it->second.value});
+  return rocksdb::Status::OK();
+}
@@ -0,0 +1,105 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_APPLYBATCH_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_APPLYBATCH_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <rocksdb/db.h>
+#include "command.h"
+
+struct RocksDB;
+
+enum ChangeType : int {
+  CHANGE_PUT = 0,
+  CHANGE_DELETE = 1,
+  CHANGE_DELETE_RANGE = 2,
+  // a merge into a key not read by the batch, only RocksDB knows its result
+  CHANGE_MERGE = 3,
+};
+
+// a key changed by an ApplyBatch
+struct KeyChange {
+  // the index of the entry making the change
+  uint64_t index;
+  ChangeType type;
+  std::string key;
+  // the value of a put, the operation of a merge as "incr 1", the end of a
+  // deleted range
+  std::string value;
+};
+
+// ApplyBatch accumulates the mutations of one batchedUpdate call into a
+// WriteBatch and serves the reads of conditional commands on top of it, keys
+// read or written in the batch are cached so repeated keys in one batch only
+// hit RocksDB once
+class ApplyBatch {
+ public:
+  // appliedTime is the Raft-applied time in unix milliseconds, ttlInUse is
+  // true once a put with TTL has been applied to the group
+  ApplyBatch(RocksDB *rocks, uint64_t appliedTime, bool ttlInUse);
+  // evaluates the conditions of cmd and applies its mutations if all hold
+  rocksdb::Status Apply(const Command &cmd, CommandStatus *status);
+  // marks the mutations applied so far as belonging to entries up to index
+  void SetAppliedIndex(uint64_t index) noexcept;
+  // writes the pending mutations together with the applied index
+  rocksdb::Status Write(const rocksdb::WriteOptions &wo);
+  // bytes pending or written by this batch
+  uint64_t Bytes() const noexcept;
+  uint64_t AppliedTime() const noexcept;
+  bool TTLInUse() const noexcept;
+  // the changes made by the batch in the order they were applied
+  const std::vector<KeyChange> &Changes() const noexcept;
+ private:
+  struct Cached {
+    bool found;
+    std::string value;
+    uint64_t expiry;
+  };
+  // loads key into the cache, expired values are kept with their expiry
+  rocksdb::Status load(const std::string &key, Cached **entry);
+  // sets found to false if key does not exist or has expired
+  rocksdb::Status get(const std::string &key, std::string *value, bool *found);
+  void put(const std::string &key, const std::string &value, uint64_t ttl);
+  void remove(const std::string &key);
+  // deletes [begin, end) except the internal keys
+  void removeRange(const std::string &begin, const std::string &end);
+  rocksdb::Status merge(const std::string &key, const std::string &operand);
+  RocksDB *rocks_;
+  rocksdb::WriteBatch wb_;
+  uint64_t appliedIndex_;
+  uint64_t written_;
+  uint64_t appliedTime_;
+  bool timeChanged_;
+  // once TTL values may exist, merges are applied as read-modify-write puts
+  // because the compaction filter can drop an expired base value beneath
+  // merge operands it does not see
+  bool ttlInUse_;
+  bool ttlChanged_;
+  std::unordered_map<std::string, Cached> cache_;
+  // uncached keys with merge operands pending in wb_, a read of these keys
+  // must go through RocksDB's merge operator
+  std::unordered_set<std::string> merged_;
+  // ranges deleted by the pending wb_, uncached keys in them are not found
+  std::vector<std::pair<std::string, std::string>> removed_;
+  std::vector<KeyChange> changes_;
+  // changes before stamped_ have their index set
+  size_t stamped_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_APPLYBATCH_H_
@@ -0,0 +1,153 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include "command.h"
+#include "utils.h"
+
+static bool parseUint64(const std::string &value, uint64_t *result)
+{
+  if (value.empty() || value[0] == '-') {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  *result = std::strtoull(value.c_str(), &end, 10);
+  return errno == 0 && *end == '\0';
+}
+
+static bool isUint64(const std::string &value)
+{
+  uint64_t result;
+  return parseUint64(value, &result);
+}
+
+static bool parseMutationType(const std::string &verb, MutationType *type)
+{
+  if (verb == "put") {
+    *type = MUT_PUT;
+  } else if (verb == "incr") {
+    *type = MUT_INCR;
+  } else if (verb == "append") {
+    *type = MUT_APPEND;
+  } else if (verb == "max") {
+    *type = MUT_MAX;
+  } else if (verb == "del") {
+    *type = MUT_DELETE;
+  } else if (verb == "delrange") {
+    *type = MUT_DELETE_RANGE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// parses one condition or mutation starting at parts[pos], advances pos
+static bool parseOp(
+  const std::vector<std::string> &parts,
+  size_t *pos,
+  Command *cmd)
+{
+  auto &verb = parts[*pos];
+  auto remaining = parts.size() - *pos - 1;
+  if (verb == "eq" || verb == "nx") {
+    Condition cond;
+    cond.type = verb == "eq" ? COND_EQUAL : COND_ABSENT;
+    size_t args = cond.type == COND_EQUAL ? 2 : 1;
+    if (remaining < args) {
+      return false;
+    }
+    cond.key = parts[*pos + 1];
+    if (isReservedKey(cond.key)) {
+      return false;
+    }
+    if (args == 2) {
+      cond.value = parts[*pos + 2];
+    }
+    cmd->conditions.push_back(std::move(cond));
+    *pos += args + 1;
+    return true;
+  }
+  Mutation mut;
+  mut.ttl = 0;
+  bool withTTL = verb == "putttl";
+  if (withTTL) {
+    mut.type = MUT_PUT;
+  } else if (!parseMutationType(verb, &mut.type)) {
+    return false;
+  }
+  size_t args = mut.type == MUT_DELETE ? 1 : (withTTL ? 3 : 2);
+  if (remaining < args) {
+    return false;
+  }
+  mut.key = parts[*pos + 1];
+  if (isReservedKey(mut.key)) {
+    return false;
+  }
+  if (args >= 2) {
+    mut.value = parts[*pos + 2];
+  }
+  if (withTTL && (!parseUint64(parts[*pos + 3], &mut.ttl) || mut.ttl == 0)) {
+    return false;
+  }
+  if ((mut.type == MUT_INCR || mut.type == MUT_MAX) && !isUint64(mut.value)) {
+    return false;
+  }
+  if (mut.type == MUT_DELETE_RANGE && mut.key >= mut.value) {
+    return false;
+  }
+  cmd->mutations.push_back(std::move(mut));
+  *pos += args + 1;
+  return true;
+}
+
+bool parseCommand(const char *data, size_t size, Command *cmd)
+{
+  cmd->conditions.clear();
+  cmd->mutations.clear();
+  cmd->tick = 0;
+  std::stringstream ss({data, size});
+  std::vector<std::string> parts;
+  for (std::string part; ss >> part;) {
+    parts.push_back(std::move(part));
+  }
+  if (parts.empty()) {
+    return false;
+  }
+  if (parts[0] == "txn") {
+    for (size_t pos = 1; pos < parts.size();) {
+      if (!parseOp(parts, &pos, cmd)) {
+        return false;
+      }
+    }
+    return !cmd->mutations.empty();
+  }
+  if (parts[0] == "tick") {
+    return parts.size() == 2
+      && parseUint64(parts[1], &cmd->tick) && cmd->tick != 0;
+  }
+  if (parts[0] == "cas") {
+    if (parts.size() != 4 || isReservedKey(parts[1])) {
+      return false;
+    }
+    cmd->conditions.push_back({COND_EQUAL, parts[1], parts[2]});
+    cmd->mutations.push_back({MUT_PUT, parts[1], parts[3], 0});
+    return true;
+  }
+  size_t pos = 0;
+  return parseOp(parts, &pos, cmd)
+    && cmd->conditions.empty() && pos == parts.size();
+}
@@ -0,0 +1,88 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_COMMAND_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_COMMAND_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// commands proposed to DiskKV, one per Raft entry or several packed into a
+// batch entry (see proposalbatcher.h):
+// put key value
+// incr key delta      - unsigned 64-bit addition, wraps around
+// append key suffix
+// max key value       - keeps the larger unsigned 64-bit value
+// cas key expected value
+// txn op...           - op is one of
+//                       eq key value (condition: key holds value)
+//                       nx key       (condition: key does not exist)
+//                       put/incr/append/max key value
+//                       del key
+// incr/append/max are blind writes resolved by the merge operator, the
+// mutations of cas/txn are applied atomically only if all conditions hold,
+// keys starting with a NUL are reserved for tagged queries (see utils.h)
+enum MutationType : int {
+  MUT_PUT = 0,
+  MUT_INCR = 1,
+  MUT_APPEND = 2,
+  MUT_MAX = 3,
+  MUT_DELETE = 4,
+  // deletes [key, value)
+  MUT_DELETE_RANGE = 5,
+};
+
+enum ConditionType : int {
+  COND_EQUAL = 0,
+  COND_ABSENT = 1,
+};
+
+// the status of a command, returned as the entry result
+enum CommandStatus : uint64_t {
+  STATUS_OK = 0,
+  STATUS_CONDITION_FAILED = 1,
+  STATUS_INVALID_COMMAND = 2,
+};
+
+// bits of the status of each command in the result of a batch entry
+constexpr size_t statusBits = 2;
+
+struct Mutation {
+  MutationType type;
+  std::string key;
+  std::string value;
+  // milliseconds to live after the Raft-applied time, 0 for puts that never
+  // expire and for all other mutation types
+  uint64_t ttl;
+};
+
+struct Condition {
+  ConditionType type;
+  std::string key;
+  std::string value;
+};
+
+struct Command {
+  std::vector<Condition> conditions;
+  std::vector<Mutation> mutations;
+  // non-zero for a tick advancing the Raft-applied time to the given unix
+  // milliseconds, a tick carries neither conditions nor mutations
+  uint64_t tick;
+};
+
+// returns false if the command is malformed
+bool parseCommand(const char *data, size_t size, Command *cmd);
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_COMMAND_H_
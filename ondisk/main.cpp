@@ -16,19 +16,36 @@
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <functional>
 #include <getopt.h>
 #include <dragonboat/dragonboat.h>
 #include "zupply.hpp"
 #include "statemachine.h"
+#include "command.h"
+#include "proposalbatcher.h"
+#include "readcoordinator.h"
+#include "stalereader.h"
+#include "ticker.h"
 
 constexpr uint64_t ClusterID = 128;
 
 enum RequestType : int {
   EXIT = 0,
-  PUT = 1,
+  UPDATE = 1,
   GET = 2,
   ADD_NODE = 3,
   REMOVE_NODE = 4,
+  STATS = 5,
+  BENCH = 6,
+  GET_BENCH = 7,
+  STALE_GET = 8,
+  WATCH = 9,
   UNKNOWN,
 };
 
@@ -43,42 +60,153 @@ void printUsage()
   std::cout
     << "Usage - \n"
     << "put key value\n"
+    << "putttl key value ttl_ms\n"
+    << "incr key delta\n"
+    << "append key suffix\n"
+    << "max key value\n"
+    << "del key\n"
+    << "delrange begin end\n"
+    << "cas key expected value\n"
+    << "txn [eq key value] [nx key] [put key value] [del key] "
+    << "[delrange begin end] ...\n"
     << "get key\n"
+    << "staleget key max_staleness_ms\n"
+    << "stats\n"
+    << "watch prefix\n"
+    << "bench count [concurrency]\n"
+    << "getbench count [concurrency]\n"
     << "exit" << std::endl;
 }
 
 std::tuple<RequestType, std::string, std::string> parseRequest(std::string &msg)
 {
   auto parts = zz::fmt::split(msg);
-  if (parts.empty() || parts.size() > 3) {
+  if (parts.empty()) {
     return {UNKNOWN, "", ""};
-  } else if (zz::fmt::to_lower_ascii(parts[0]) == "exit") {
+  }
+  auto verb = zz::fmt::to_lower_ascii(parts[0]);
+  if (verb == "cas" || verb == "txn" || verb == "putttl") {
+    // validated by the state machine
+    return {UPDATE, msg, ""};
+  } else if (parts.size() > 3) {
+    return {UNKNOWN, "", ""};
+  } else if (verb == "exit") {
     return {EXIT, "", ""};
-  } else if (zz::fmt::to_lower_ascii(parts[0]) == "put") {
-    assert(parts.size() == 3);
-    return {PUT, std::move(parts[1]), std::move(parts[2])};
-  } else if (zz::fmt::to_lower_ascii(parts[0]) == "get") {
+  } else if (verb == "put" || verb == "incr"
+    || verb == "append" || verb == "max") {
+    if (parts.size() != 3) {
+      return {UNKNOWN, "", ""};
+    }
+    return {UPDATE, verb + " " + parts[1] + " " + parts[2], ""};
+  } else if (verb == "del") {
+    if (parts.size() != 2) {
+      return {UNKNOWN, "", ""};
+    }
+    return {UPDATE, verb + " " + parts[1], ""};
+  } else if (verb == "delrange") {
+    if (parts.size() != 3) {
+      return {UNKNOWN, "", ""};
+    }
+    return {UPDATE, verb + " " + parts[1] + " " + parts[2], ""};
+  } else if (verb == "staleget") {
+    if (parts.size() != 3) {
+      return {UNKNOWN, "", ""};
+    }
+    return {STALE_GET, std::move(parts[1]), std::move(parts[2])};
+  } else if (verb == "watch") {
+    if (parts.size() != 2) {
+      return {UNKNOWN, "", ""};
+    }
+    return {WATCH, std::move(parts[1]), ""};
+  } else if (verb == "get") {
     return {GET, std::move(parts[1]), ""};
-  } else if (zz::fmt::to_lower_ascii(parts[0]) == "add") {
+  } else if (verb == "add") {
     return {ADD_NODE, std::move(parts[1]), std::move(parts[2])};
-  } else if (zz::fmt::to_lower_ascii(parts[0]) == "remove") {
+  } else if (verb == "remove") {
     return {REMOVE_NODE, std::move(parts[1]), ""};
+  } else if (verb == "stats") {
+    return {STATS, statsQuery, ""};
+  } else if (verb == "bench" && parts.size() >= 2) {
+    return {BENCH, parts[1], parts.size() > 2 ? parts[2] : "16"};
+  } else if (verb == "getbench" && parts.size() >= 2) {
+    return {GET_BENCH, parts[1], parts.size() > 2 ? parts[2] : "16"};
   } else {
     return {UNKNOWN, "", ""};
   }
 }
 
+// runs op(i) for every i in [0, count) from concurrency threads, op returns
+// false if it failed
+void runBench(
+  const std::string &name,
+  uint64_t count,
+  uint64_t concurrency,
+  const std::function<bool(uint64_t)> &op)
+{
+  std::atomic<uint64_t> next(0);
+  std::atomic<uint64_t> failed(0);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < concurrency; ++t) {
+    threads.emplace_back([count, &op, &next, &failed]()
+    {
+      for (auto i = next++; i < count; i = next++) {
+        if (!op(i)) {
+          failed++;
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  std::cout
+    << count << " " << name << " in " << ms << "ms, "
+    << count * 1000 / std::max<uint64_t>(ms, 1) << " " << name << "/s, "
+    << failed.load() << " failed" << std::endl;
+}
+
 int main(int argc, char **argv, char **env)
 {
   int ret;
   uint64_t nodeID = 0;
   bool join = false;
   std::string address;
+  DiskKVOptions kvOptions;
+  SharedDBOptions sharedOptions;
+  uint64_t tickMillis = 1000;
+  uint64_t trashRateMB = 0;
+  // client-side proposal batching, disabled if maxBytes is 0
+  ProposalBatcherOptions batchOptions;
+  batchOptions.maxBytes = 0;
+  batchOptions.resultBits = statusBits;
+  // reads share ReadIndex requests if readWindowMicros is not 0
+  uint64_t readWindowMicros = 0;
   // for simplicity, membership change is removed in this example
   struct ::option opts[] = {
     {"nodeid", required_argument, nullptr, 0},
     {"addr", required_argument, nullptr, 1},
     {"join", no_argument, nullptr, 2},
+    {"coalesce_bytes", required_argument, nullptr, 3},
+    {"coalesce_us", required_argument, nullptr, 4},
+    {"shared_db", no_argument, nullptr, 5},
+    {"profile", required_argument, nullptr, 6},
+    {"rocksdb_config", required_argument, nullptr, 7},
+    {"tick_ms", required_argument, nullptr, 8},
+    {"snapshot_threads", required_argument, nullptr, 9},
+    {"recover_threads", required_argument, nullptr, 10},
+    {"snapshot_codec", required_argument, nullptr, 11},
+    {"snapshot_rate_mb", required_argument, nullptr, 12},
+    {"snapshot_readahead_kb", required_argument, nullptr, 13},
+    {"trash_rate_mb", required_argument, nullptr, 14},
+    {"bloom_bits", required_argument, nullptr, 15},
+    {"row_cache_mb", required_argument, nullptr, 16},
+    {"batch_kb", required_argument, nullptr, 17},
+    {"batch_us", required_argument, nullptr, 18},
+    {"read_window_us", required_argument, nullptr, 19},
+    {nullptr, 0, nullptr, 0},
   };
 
   while ((ret = getopt_long_only(argc, argv, "", opts, nullptr)) != -1) {
@@ -89,6 +217,58 @@ int main(int argc, char **argv, char **env)
         break;
       case 2:join = true;
         break;
+      case 3:kvOptions.coalesceBytes = std::stoull(optarg);
+        break;
+      case 4:kvOptions.coalesceMicros = std::stoull(optarg);
+        break;
+      case 5:sharedOptions.singleDB = true;
+        break;
+      case 6:
+        if (!GetRocksDBPreset(optarg, &kvOptions.profile)) {
+          std::cerr << "unknown profile " << optarg << std::endl;
+          return -1;
+        }
+        break;
+      case 7: {
+        std::string err;
+        if (!LoadRocksDBProfile(optarg, &kvOptions.profile, &err)) {
+          std::cerr << "invalid rocksdb config: " << err << std::endl;
+          return -1;
+        }
+        break;
+      }
+      case 8:tickMillis = std::stoull(optarg);
+        break;
+      case 9:kvOptions.snapshotThreads = std::stoull(optarg);
+        break;
+      case 10:kvOptions.recoverThreads = std::stoull(optarg);
+        break;
+      case 11:
+        if (!ParseSnapshotCodec(optarg, &kvOptions.snapshotCodec)) {
+          std::cerr << "unsupported snapshot codec " << optarg << std::endl;
+          return -1;
+        }
+        break;
+      case 12:
+        if (std::stoull(optarg) != 0) {
+          kvOptions.snapshotLimiter = std::make_shared<TokenBucket>(
+            std::stoull(optarg) * 1024 * 1024);
+        }
+        break;
+      case 13:kvOptions.snapshotReadaheadBytes = std::stoull(optarg) * 1024;
+        break;
+      case 14:trashRateMB = std::stoull(optarg);
+        break;
+      case 15:kvOptions.bloomBitsPerKey = std::stoull(optarg);
+        break;
+      case 16:kvOptions.rowCacheBytes = std::stoull(optarg) * 1024 * 1024;
+        break;
+      case 17:batchOptions.maxBytes = std::stoull(optarg) * 1024;
+        break;
+      case 18:batchOptions.lingerMicros = std::stoull(optarg);
+        break;
+      case 19:readWindowMicros = std::stoull(optarg);
+        break;
       default:std::cerr << "unknown ret " << ret << std::endl;
         break;
     }
@@ -116,6 +296,20 @@ int main(int argc, char **argv, char **env)
     peers.AddMember(addresses[idx], idx + 1);
   }
 
+  std::stringstream shared;
+  shared << testDBDirName << "/shared-node" << nodeID;
+  sharedOptions.dir = shared.str();
+  kvOptions.shared =
+    std::make_shared<SharedRocksDB>(sharedOptions, kvOptions.profile);
+  std::stringstream trash;
+  trash << testDBDirName << "/trash-node" << nodeID;
+  kvOptions.trash = std::make_shared<TrashReclaimer>(
+    trash.str(), trashRateMB * 1024 * 1024);
+  std::cout
+    << "rocksdb profile:\n" << kvOptions.profile.ToString() << std::endl;
+
+  kvOptions.watch = std::make_shared<WatchHub>();
+
   std::stringstream path;
   path << "example-data/ondisk-data/node" << nodeID;
   dragonboat::NodeHostConfig nhconfig(path.str(), path.str());
@@ -126,9 +320,9 @@ int main(int argc, char **argv, char **env)
   std::unique_ptr<dragonboat::NodeHost> nh(new dragonboat::NodeHost(nhconfig));
   status = nh->StartCluster(
     peers, join,
-    [](uint64_t clusterID, uint64_t nodeID)
+    [kvOptions](uint64_t clusterID, uint64_t nodeID)
     {
-      return new DiskKV(clusterID, nodeID);
+      return new DiskKV(clusterID, nodeID, kvOptions);
     }, config);
   if (!status.OK()) {
     std::cerr << "failed to StartCluster: " << status.Code() << std::endl;
@@ -146,6 +340,48 @@ int main(int argc, char **argv, char **env)
   };
   auto timeout = dragonboat::Milliseconds(3000);
   std::unique_ptr<dragonboat::Session> session(nh->GetNoOPSession(ClusterID));
+  std::unique_ptr<ProposalBatcher> batcher;
+  if (batchOptions.maxBytes != 0) {
+    batchOptions.timeout = timeout;
+    batcher.reset(new ProposalBatcher(nh.get(), ClusterID, batchOptions));
+  }
+  std::unique_ptr<ReadCoordinator> reader;
+  if (readWindowMicros != 0) {
+    ReadCoordinatorOptions readOptions;
+    readOptions.windowMicros = readWindowMicros;
+    readOptions.timeout = timeout;
+    reader.reset(new ReadCoordinator(nh.get(), readOptions));
+  }
+  StaleReader staleReader(nh.get(), timeout, reader.get());
+  auto read = [&nh, &reader, timeout](
+    const dragonboat::Buffer &query,
+    dragonboat::Buffer *result)
+  {
+    if (reader) {
+      return reader->Read(ClusterID, query, result);
+    }
+    return nh->SyncRead(ClusterID, query, result, timeout);
+  };
+  // advances the Raft-applied time used by putttl and staleget while the
+  // group may hold TTL values or is read through staleReader, ticks from
+  // several nodes are harmless as the state machine keeps the largest one
+  std::unique_ptr<Ticker> ticker(new Ticker(
+    nh.get(), {ClusterID}, tickMillis, timeout, &staleReader,
+    [&nh, &staleReader](uint64_t clusterID)
+    {
+      if (staleReader.SinceLastRead(clusterID) < staleReadDemandMillis) {
+        return true;
+      }
+      dragonboat::Buffer query(
+        reinterpret_cast<const dragonboat::Byte *>(ttlInUseQuery.data()),
+        ttlInUseQuery.size());
+      dragonboat::Buffer result(8);
+      auto status = nh->StaleRead(clusterID, query, &result);
+      return status.OK() && result.Len() == 1 && result.Data()[0] == '1';
+    }));
+  std::atomic<bool> stopped(false);
+  // one consumer thread per watch, printing the events pushed by batchedUpdate
+  std::vector<std::thread> watchers;
   dragonboat::Buffer result(1024);
   for (std::string message; std::getline(std::cin, message);) {
     auto request = parseRequest(message);
@@ -156,19 +392,117 @@ int main(int argc, char **argv, char **env)
       case EXIT: {
         break;
       }
-      case PUT: {
+      case UPDATE: {
         dragonboat::Buffer query(
           reinterpret_cast<const dragonboat::Byte *>(key.c_str()),
           key.size());
         dragonboat::UpdateResult ret;
-        status = nh->SyncPropose(session.get(), query, timeout, &ret);
+        if (batcher) {
+          status = batcher->Propose(key, &ret);
+        } else {
+          status = nh->SyncPropose(session.get(), query, timeout, &ret);
+        }
+        if (status.OK() && ret == STATUS_CONDITION_FAILED) {
+          std::cout << "condition failed" << std::endl;
+        } else if (status.OK() && ret == STATUS_INVALID_COMMAND) {
+          std::cout << "invalid command" << std::endl;
+        }
         break;
       }
       case GET: {
         dragonboat::Buffer query(
           reinterpret_cast<const dragonboat::Byte *>(key.c_str()),
           key.size());
-        status = nh->SyncRead(ClusterID, query, &result, timeout);
+        status = read(query, &result);
+        if (status.OK()) {
+          std::cout << std::string(
+            reinterpret_cast<const char *>(result.Data()), result.Len())
+            << std::endl;
+        }
+        break;
+      }
+      case STALE_GET: {
+        dragonboat::Buffer query(
+          reinterpret_cast<const dragonboat::Byte *>(key.c_str()),
+          key.size());
+        bool local = false;
+        status = staleReader.Read(
+          ClusterID, query, &result, std::stoull(value), &local);
+        if (status.OK()) {
+          std::cout << std::string(
+            reinterpret_cast<const char *>(result.Data()), result.Len())
+            << (local ? "" : " (linearizable)") << std::endl;
+        }
+        break;
+      }
+      case WATCH: {
+        auto sub = kvOptions.watch->Subscribe(key, true);
+        watchers.emplace_back([&kvOptions, &stopped, sub]()
+        {
+          WatchEvent event;
+          while (!stopped) {
+            if (sub->Wait(&event, std::chrono::milliseconds(100))) {
+              std::cout << "watch: " << formatWatchEvent(event) << std::endl;
+            }
+          }
+          kvOptions.watch->Unsubscribe(sub);
+        });
+        break;
+      }
+      case STATS: {
+        dragonboat::Buffer query(
+          reinterpret_cast<const dragonboat::Byte *>(key.c_str()),
+          key.size());
+        dragonboat::Buffer stats(4096);
+        status = read(query, &stats);
+        if (status.OK()) {
+          std::cout << std::string(
+            reinterpret_cast<const char *>(stats.Data()), stats.Len())
+            << std::endl;
+        }
+        if (reader) {
+          std::cout << reader->ToString() << std::endl;
+        }
+        std::cout << staleReader.ToString() << std::endl;
+        break;
+      }
+      case BENCH: {
+        // NoOP sessions can be shared by concurrent proposals
+        auto put = [&nh, &batcher, &session, timeout](uint64_t i)
+        {
+          auto cmd = "put bench" + std::to_string(i) + " " + std::to_string(i);
+          dragonboat::UpdateResult ret = 0;
+          dragonboat::Status s;
+          if (batcher) {
+            s = batcher->Propose(cmd, &ret);
+          } else {
+            dragonboat::Buffer buf(
+              reinterpret_cast<const dragonboat::Byte *>(cmd.c_str()),
+              cmd.size());
+            s = nh->SyncPropose(session.get(), buf, timeout, &ret);
+          }
+          return s.OK() && ret == STATUS_OK;
+        };
+        runBench("puts", std::stoull(key), std::stoull(value), put);
+        if (batcher) {
+          std::cout << batcher->ToString() << std::endl;
+        }
+        break;
+      }
+      case GET_BENCH: {
+        auto get = [&read](uint64_t i)
+        {
+          auto key = "bench" + std::to_string(i);
+          dragonboat::Buffer query(
+            reinterpret_cast<const dragonboat::Byte *>(key.c_str()),
+            key.size());
+          dragonboat::Buffer result(64);
+          return read(query, &result).OK();
+        };
+        runBench("gets", std::stoull(key), std::stoull(value), get);
+        if (reader) {
+          std::cout << reader->ToString() << std::endl;
+        }
         break;
       }
       case ADD_NODE: {
@@ -191,5 +525,11 @@ int main(int argc, char **argv, char **env)
     }
     statusAssert(message, status);
   }
+  stopped = true;
+  ticker.reset();
+  for (auto &watcher : watchers) {
+    watcher.join();
+  }
+  batcher.reset();
   nh->Stop();
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "manifest.h"
+#include "crc32.h"
+#include "zupply.hpp"
+
+std::string encodeManifest(const DBManifest &manifest)
+{
+  std::string data(manifestMagic, sizeof(manifestMagic));
+  data.push_back(manifestVersion);
+  auto len = static_cast<uint32_t>(manifest.dbdir.size());
+  data.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  data.append(manifest.dbdir);
+  data.append(
+    reinterpret_cast<const char *>(&manifest.appliedIndex), sizeof(uint64_t));
+  auto crc = crc32(data.data(), data.size());
+  data.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+  return data;
+}
+
+bool decodeManifest(const std::string &data, DBManifest *manifest)
+{
+  constexpr size_t header = sizeof(manifestMagic) + 1 + sizeof(uint32_t);
+  if (data.size() < sizeof(manifestMagic)
+    || memcmp(data.data(), manifestMagic, sizeof(manifestMagic)) != 0) {
+    // the current file of older versions only holds the db dir name
+    manifest->dbdir = zz::fmt::trim(data);
+    manifest->appliedIndex = 0;
+    return !manifest->dbdir.empty();
+  }
+  if (data.size() < header + sizeof(uint64_t) + sizeof(uint32_t)
+    || data[sizeof(manifestMagic)] != manifestVersion) {
+    return false;
+  }
+  uint32_t len = 0;
+  memcpy(&len, data.data() + sizeof(manifestMagic) + 1, sizeof(len));
+  if (data.size() != header + len + sizeof(uint64_t) + sizeof(uint32_t)) {
+    return false;
+  }
+  uint32_t crc = 0;
+  memcpy(&crc, data.data() + data.size() - sizeof(crc), sizeof(crc));
+  if (crc != crc32(data.data(), data.size() - sizeof(crc))) {
+    return false;
+  }
+  manifest->dbdir.assign(data.data() + header, len);
+  memcpy(&manifest->appliedIndex, data.data() + header + len, sizeof(uint64_t));
+  return true;
+}
+
+bool hasManifest(const std::string &dir) noexcept
+{
+  return zz::os::is_file(zz::os::path_join({dir, currentDBFilename}))
+    || zz::os::is_file(zz::os::path_join({dir, previousDBFilename}));
+}
+
+static std::runtime_error ioError(const std::string &what)
+{
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+static void writeAndSync(const std::string &fp, const std::string &data)
+{
+  int fd = ::open(fp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw ioError("failed to create " + fp);
+  }
+  size_t written = 0;
+  while (written < data.size()) {
+    auto n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      ::close(fd);
+      throw ioError("failed to write " + fp);
+    }
+    written += n;
+  }
+  if (::fsync(fd) != 0) {
+    ::close(fd);
+    throw ioError("failed to sync " + fp);
+  }
+  ::close(fd);
+}
+
+static void syncDir(const std::string &dir)
+{
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw ioError("failed to open " + dir);
+  }
+  if (::fsync(fd) != 0) {
+    ::close(fd);
+    throw ioError("failed to sync " + dir);
+  }
+  ::close(fd);
+}
+
+void saveManifest(const std::string &dir, const DBManifest &manifest)
+{
+  auto fp = zz::os::path_join({dir, currentDBFilename});
+  auto tmpFp = zz::os::path_join({dir, updatingDBFilename});
+  auto prevFp = zz::os::path_join({dir, previousDBFilename});
+  writeAndSync(tmpFp, encodeManifest(manifest));
+  // current stays in place until the rename so that there is always a valid
+  // manifest, current.prev is only the fallback
+  if (zz::os::is_file(fp)) {
+    if (::unlink(prevFp.c_str()) != 0 && errno != ENOENT) {
+      throw ioError("failed to remove " + prevFp);
+    }
+    if (::link(fp.c_str(), prevFp.c_str()) != 0) {
+      throw ioError("failed to link " + fp + " to " + prevFp);
+    }
+  }
+  if (::rename(tmpFp.c_str(), fp.c_str()) != 0) {
+    throw ioError("failed to rename " + tmpFp + " to " + fp);
+  }
+  syncDir(dir);
+}
+
+static bool loadManifest(const std::string &fp, DBManifest *manifest)
+{
+  std::fstream f(fp, std::ios::in | std::ios::binary);
+  if (!f) {
+    return false;
+  }
+  std::string data(
+    (std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  return decodeManifest(data, manifest);
+}
+
+std::vector<DBManifest> loadManifests(const std::string &dir)
+{
+  std::vector<DBManifest> manifests;
+  for (auto &name : {currentDBFilename, previousDBFilename}) {
+    DBManifest manifest;
+    if (loadManifest(zz::os::path_join({dir, name}), &manifest)) {
+      manifests.push_back(std::move(manifest));
+    } else {
+      std::cerr << "no valid manifest " << name << " in " << dir << std::endl;
+    }
+  }
+  return manifests;
+}
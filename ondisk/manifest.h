@@ -0,0 +1,58 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_MANIFEST_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_MANIFEST_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// the manifest of a node data dir points to its current DB dir, the replaced
+// manifest is kept as current.prev so that a damaged current file falls back
+// to the previous DB dir instead of requiring a full snapshot
+const std::string currentDBFilename = "current";
+const std::string updatingDBFilename = "current.updating";
+const std::string previousDBFilename = "current.prev";
+
+// magic version dbdirlen(uint32) dbdir appliedindex(uint64) crc32(uint32),
+// integers in native byte order
+const char manifestMagic[] = {'D', 'K', 'V', 'M'};
+const char manifestVersion = 1;
+
+struct DBManifest {
+  std::string dbdir;
+  // applied index when the manifest was written, the DB is never behind it
+  uint64_t appliedIndex = 0;
+};
+
+std::string encodeManifest(const DBManifest &manifest);
+
+// accepts the plain dbdir name written by older versions, returns false if
+// the data is torn or corrupted
+bool decodeManifest(const std::string &data, DBManifest *manifest);
+
+// returns true if dir has a current or previous manifest
+bool hasManifest(const std::string &dir) noexcept;
+
+// writes and fsyncs current.updating, keeps the current manifest as
+// current.prev, renames current.updating to current and fsyncs dir, throws
+// std::runtime_error on failure
+void saveManifest(const std::string &dir, const DBManifest &manifest);
+
+// returns the valid manifests of dir, the current one first
+std::vector<DBManifest> loadManifests(const std::string &dir);
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_MANIFEST_H_
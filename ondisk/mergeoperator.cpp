@@ -0,0 +1,145 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mergeoperator.h"
+
+static uint64_t toUint64(const char *data, size_t size)
+{
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (data[i] < '0' || data[i] > '9') {
+      return 0;
+    }
+    value = value * 10 + (data[i] - '0');
+  }
+  return value;
+}
+
+static uint64_t toUint64(const rocksdb::Slice &slice)
+{
+  return toUint64(slice.data(), slice.size());
+}
+
+bool applyMergeOperand(std::string *value, const rocksdb::Slice &operand)
+{
+  if (operand.empty()) {
+    return false;
+  }
+  rocksdb::Slice arg(operand.data() + 1, operand.size() - 1);
+  switch (operand[0]) {
+    case addOperand:
+      *value = std::to_string(
+        toUint64(value->data(), value->size()) + toUint64(arg));
+      return true;
+    case maxOperand: {
+      auto current = toUint64(value->data(), value->size());
+      auto candidate = toUint64(arg);
+      *value = std::to_string(current > candidate ? current : candidate);
+      return true;
+    }
+    case appendOperand:
+      value->append(arg.data(), arg.size());
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string describeMergeOperand(const rocksdb::Slice &operand)
+{
+  if (operand.empty()) {
+    return std::string();
+  }
+  std::string arg(operand.data() + 1, operand.size() - 1);
+  switch (operand[0]) {
+    case addOperand:return "incr " + arg;
+    case maxOperand:return "max " + arg;
+    case appendOperand:return "append " + arg;
+    default:return std::string();
+  }
+}
+
+std::string encodeMergeOperand(const Mutation &mut)
+{
+  std::string operand;
+  operand.reserve(mut.value.size() + 1);
+  switch (mut.type) {
+    case MUT_INCR:operand.push_back(addOperand);
+      break;
+    case MUT_APPEND:operand.push_back(appendOperand);
+      break;
+    case MUT_MAX:operand.push_back(maxOperand);
+      break;
+    default:break;
+  }
+  operand.append(mut.value);
+  return operand;
+}
+
+bool DiskKVMergeOperator::FullMergeV2(
+  const MergeOperationInput &merge_in,
+  MergeOperationOutput *merge_out) const
+{
+  auto &value = merge_out->new_value;
+  value.clear();
+  if (merge_in.existing_value != nullptr) {
+    value.assign(
+      merge_in.existing_value->data(), merge_in.existing_value->size());
+  }
+  for (auto &operand : merge_in.operand_list) {
+    if (!applyMergeOperand(&value, operand)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DiskKVMergeOperator::PartialMerge(
+  const rocksdb::Slice &key,
+  const rocksdb::Slice &left_operand,
+  const rocksdb::Slice &right_operand,
+  std::string *new_value,
+  rocksdb::Logger *logger) const
+{
+  // only operands of the same kind can be combined without the base value
+  if (left_operand.empty() || right_operand.empty()
+    || left_operand[0] != right_operand[0]) {
+    return false;
+  }
+  rocksdb::Slice left(left_operand.data() + 1, left_operand.size() - 1);
+  rocksdb::Slice right(right_operand.data() + 1, right_operand.size() - 1);
+  new_value->assign(1, left_operand[0]);
+  switch (left_operand[0]) {
+    case addOperand:
+      new_value->append(std::to_string(toUint64(left) + toUint64(right)));
+      return true;
+    case maxOperand: {
+      auto l = toUint64(left);
+      auto r = toUint64(right);
+      new_value->append(std::to_string(l > r ? l : r));
+      return true;
+    }
+    case appendOperand:
+      new_value->append(left.data(), left.size());
+      new_value->append(right.data(), right.size());
+      return true;
+    default:
+      return false;
+  }
+}
+
+const char *DiskKVMergeOperator::Name() const
+{
+  return "DiskKVMergeOperator";
+}
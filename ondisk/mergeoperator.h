@@ -0,0 +1,53 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_MERGEOPERATOR_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_MERGEOPERATOR_H_
+
+#include <string>
+#include <rocksdb/merge_operator.h>
+#include "command.h"
+
+// a merge operand is the operation tag followed by its argument, numbers are
+// kept in decimal so counters can be read back with a plain get
+const char addOperand = 'a';
+const char appendOperand = 'p';
+const char maxOperand = 'm';
+
+// returns the merge operand of an incr/append/max mutation
+std::string encodeMergeOperand(const Mutation &mut);
+
+// applies one operand to value in place as the merge operator would, returns
+// false if the operand is invalid
+bool applyMergeOperand(std::string *value, const rocksdb::Slice &operand);
+// returns the command form of an operand, e.g. "incr 1"
+std::string describeMergeOperand(const rocksdb::Slice &operand);
+
+// DiskKVMergeOperator resolves incr/append/max operands, a missing or
+// non-numeric existing value counts as 0 for incr and max
+class DiskKVMergeOperator : public rocksdb::MergeOperator {
+ public:
+  bool FullMergeV2(
+    const MergeOperationInput &merge_in,
+    MergeOperationOutput *merge_out) const override;
+  bool PartialMerge(
+    const rocksdb::Slice &key,
+    const rocksdb::Slice &left_operand,
+    const rocksdb::Slice &right_operand,
+    std::string *new_value,
+    rocksdb::Logger *logger) const override;
+  const char *Name() const override;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_MERGEOPERATOR_H_
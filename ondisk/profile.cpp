@@ -0,0 +1,280 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <rocksdb/filter_policy.h>
+#include "profile.h"
+#include "zupply.hpp"
+
+static const uint64_t MB = 1024 * 1024;
+
+static rocksdb::CompressionType parseCompression(const std::string &name)
+{
+  if (name == "default") {
+    return rocksdb::kDisableCompressionOption;
+  } else if (name == "none") {
+    return rocksdb::kNoCompression;
+  } else if (name == "snappy") {
+    return rocksdb::kSnappyCompression;
+  } else if (name == "lz4") {
+    return rocksdb::kLZ4Compression;
+  } else if (name == "lz4hc") {
+    return rocksdb::kLZ4HCCompression;
+  } else if (name == "zstd") {
+    return rocksdb::kZSTD;
+  }
+  throw std::invalid_argument("unknown compression " + name);
+}
+
+static std::string compressionName(rocksdb::CompressionType type)
+{
+  switch (type) {
+    case rocksdb::kDisableCompressionOption:return "default";
+    case rocksdb::kNoCompression:return "none";
+    case rocksdb::kSnappyCompression:return "snappy";
+    case rocksdb::kLZ4Compression:return "lz4";
+    case rocksdb::kLZ4HCCompression:return "lz4hc";
+    case rocksdb::kZSTD:return "zstd";
+    default:return "unknown";
+  }
+}
+
+void RocksDBProfile::Apply(
+  rocksdb::Options *opts,
+  rocksdb::BlockBasedTableOptions *table) const
+{
+  table->block_size = blockSize;
+  table->cache_index_and_filter_blocks = cacheIndexAndFilterBlocks;
+  table->pin_l0_filter_and_index_blocks_in_cache = cacheIndexAndFilterBlocks;
+  if (dataBlockHashIndex) {
+    table->data_block_index_type =
+      rocksdb::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+  }
+  switch (filter) {
+    case BLOOM_FILTER:
+      table->filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(filterBitsPerKey));
+      break;
+    case RIBBON_FILTER:
+      table->filter_policy.reset(
+        rocksdb::NewRibbonFilterPolicy(filterBitsPerKey));
+      break;
+    default:table->filter_policy.reset();
+      break;
+  }
+  opts->write_buffer_size = writeBufferSize;
+  opts->max_write_buffer_number = maxWriteBufferNumber;
+  if (memtableBloomRatio > 0) {
+    opts->memtable_prefix_bloom_size_ratio = memtableBloomRatio;
+    opts->memtable_whole_key_filtering = true;
+  }
+  opts->compaction_style = compactionStyle;
+  opts->level0_file_num_compaction_trigger = level0CompactionTrigger;
+  if (compression != rocksdb::kDisableCompressionOption) {
+    opts->compression = compression;
+  }
+  opts->bottommost_compression = bottommostCompression;
+  if (!compressionPerLevel.empty()) {
+    opts->compression_per_level = compressionPerLevel;
+    opts->compression_per_level.resize(opts->num_levels, opts->compression);
+  }
+  opts->max_background_jobs = backgroundThreads + 1;
+  opts->enable_blob_files = enableBlobFiles;
+  if (enableBlobFiles) {
+    opts->min_blob_size = minBlobSize;
+    opts->blob_file_size = blobFileSize;
+    opts->blob_compression_type = blobCompression;
+    opts->enable_blob_garbage_collection = blobGC;
+    opts->blob_garbage_collection_age_cutoff = blobGCAgeCutoff;
+  }
+}
+
+std::string RocksDBProfile::ToString() const
+{
+  std::stringstream ss;
+  ss << "block_cache_mb = " << blockCacheBytes / MB << "\n"
+     << "write_buffer_manager_mb = " << writeBufferManagerBytes / MB << "\n"
+     << "rate_limit_mb = " << rateLimitBytesPerSec / MB << "\n"
+     << "background_threads = " << backgroundThreads << "\n"
+     << "block_size = " << blockSize << "\n"
+     << "filter = "
+     << (filter == BLOOM_FILTER ? "bloom" :
+         filter == RIBBON_FILTER ? "ribbon" : "none") << "\n"
+     << "filter_bits_per_key = " << filterBitsPerKey << "\n"
+     << "cache_index_and_filter_blocks = " << cacheIndexAndFilterBlocks << "\n"
+     << "data_block_hash_index = " << dataBlockHashIndex << "\n"
+     << "write_buffer_mb = " << writeBufferSize / MB << "\n"
+     << "max_write_buffers = " << maxWriteBufferNumber << "\n"
+     << "memtable_bloom_ratio = " << memtableBloomRatio << "\n"
+     << "compaction_style = "
+     << (compactionStyle == rocksdb::kCompactionStyleUniversal ?
+         "universal" : "level") << "\n"
+     << "l0_compaction_trigger = " << level0CompactionTrigger << "\n"
+     << "compression = " << compressionName(compression) << "\n"
+     << "bottommost_compression = "
+     << compressionName(bottommostCompression) << "\n"
+     << "compression_per_level =";
+  for (auto type : compressionPerLevel) {
+    ss << " " << compressionName(type);
+  }
+  ss << "\n"
+     << "enable_blob_files = " << enableBlobFiles << "\n"
+     << "min_blob_size = " << minBlobSize << "\n"
+     << "blob_file_mb = " << blobFileSize / MB << "\n"
+     << "blob_compression = " << compressionName(blobCompression) << "\n"
+     << "blob_gc = " << blobGC << "\n"
+     << "blob_gc_age_cutoff = " << blobGCAgeCutoff;
+  return ss.str();
+}
+
+bool GetRocksDBPreset(const std::string &name, RocksDBProfile *profile)
+{
+  RocksDBProfile p;
+  if (name == "point-lookup") {
+    // keep filters and indexes hot and avoid the binary search in data blocks
+    p.blockCacheBytes = 512 * MB;
+    p.filterBitsPerKey = 10;
+    p.cacheIndexAndFilterBlocks = true;
+    p.dataBlockHashIndex = true;
+    p.memtableBloomRatio = 0.02;
+  } else if (name == "write-heavy") {
+    // larger memtables, lazier compaction and no compression on the upper
+    // levels which are rewritten the most, compaction IO is throttled
+    p.writeBufferManagerBytes = 512 * MB;
+    p.rateLimitBytesPerSec = 64 * MB;
+    p.blockSize = 16 * 1024;
+    p.writeBufferSize = 128 * MB;
+    p.maxWriteBufferNumber = 4;
+    p.compactionStyle = rocksdb::kCompactionStyleUniversal;
+    p.level0CompactionTrigger = 8;
+    p.compressionPerLevel = {rocksdb::kNoCompression, rocksdb::kNoCompression};
+  } else if (name == "large-value") {
+    // multi-KB values go to blob files, the LSM tree only holds references
+    p.writeBufferSize = 128 * MB;
+    p.enableBlobFiles = true;
+    p.minBlobSize = 4 * 1024;
+    p.blockSize = 16 * 1024;
+  } else if (name != "default") {
+    return false;
+  }
+  *profile = p;
+  return true;
+}
+
+bool LoadRocksDBProfile(
+  const std::string &path,
+  RocksDBProfile *profile,
+  std::string *err)
+{
+  std::fstream f(path, std::ios::in);
+  if (!f.is_open()) {
+    *err = "failed to open " + path;
+    return false;
+  }
+  size_t lineno = 0;
+  for (std::string line; std::getline(f, line);) {
+    lineno++;
+    line = zz::fmt::trim(line.substr(0, line.find('#')));
+    if (line.empty()) {
+      continue;
+    }
+    auto pos = line.find('=');
+    if (pos == std::string::npos) {
+      *err = path + ":" + std::to_string(lineno) + ": missing '='";
+      return false;
+    }
+    auto key = zz::fmt::trim(line.substr(0, pos));
+    auto value = zz::fmt::to_lower_ascii(zz::fmt::trim(line.substr(pos + 1)));
+    try {
+      if (key == "preset") {
+        if (!GetRocksDBPreset(value, profile)) {
+          throw std::invalid_argument("unknown preset " + value);
+        }
+      } else if (key == "block_cache_mb") {
+        profile->blockCacheBytes = std::stoull(value) * MB;
+      } else if (key == "write_buffer_manager_mb") {
+        profile->writeBufferManagerBytes = std::stoull(value) * MB;
+      } else if (key == "rate_limit_mb") {
+        profile->rateLimitBytesPerSec = std::stoull(value) * MB;
+      } else if (key == "background_threads") {
+        profile->backgroundThreads = std::stoi(value);
+      } else if (key == "block_size") {
+        profile->blockSize = std::stoull(value);
+      } else if (key == "filter") {
+        if (value == "bloom") {
+          profile->filter = BLOOM_FILTER;
+        } else if (value == "ribbon") {
+          profile->filter = RIBBON_FILTER;
+        } else if (value == "none") {
+          profile->filter = NO_FILTER;
+        } else {
+          throw std::invalid_argument("unknown filter " + value);
+        }
+      } else if (key == "filter_bits_per_key") {
+        profile->filterBitsPerKey = std::stod(value);
+      } else if (key == "cache_index_and_filter_blocks") {
+        profile->cacheIndexAndFilterBlocks = std::stoi(value) != 0;
+      } else if (key == "data_block_hash_index") {
+        profile->dataBlockHashIndex = std::stoi(value) != 0;
+      } else if (key == "write_buffer_mb") {
+        profile->writeBufferSize = std::stoull(value) * MB;
+      } else if (key == "max_write_buffers") {
+        profile->maxWriteBufferNumber = std::stoi(value);
+      } else if (key == "memtable_bloom_ratio") {
+        profile->memtableBloomRatio = std::stod(value);
+      } else if (key == "compaction_style") {
+        if (value == "level") {
+          profile->compactionStyle = rocksdb::kCompactionStyleLevel;
+        } else if (value == "universal") {
+          profile->compactionStyle = rocksdb::kCompactionStyleUniversal;
+        } else {
+          throw std::invalid_argument("unknown compaction style " + value);
+        }
+      } else if (key == "l0_compaction_trigger") {
+        profile->level0CompactionTrigger = std::stoi(value);
+      } else if (key == "compression") {
+        profile->compression = parseCompression(value);
+      } else if (key == "bottommost_compression") {
+        profile->bottommostCompression = parseCompression(value);
+      } else if (key == "compression_per_level") {
+        profile->compressionPerLevel.clear();
+        for (auto &name : zz::fmt::split(value, ' ')) {
+          if (!name.empty()) {
+            profile->compressionPerLevel.push_back(parseCompression(name));
+          }
+        }
+      } else if (key == "enable_blob_files") {
+        profile->enableBlobFiles = std::stoi(value) != 0;
+      } else if (key == "min_blob_size") {
+        profile->minBlobSize = std::stoull(value);
+      } else if (key == "blob_file_mb") {
+        profile->blobFileSize = std::stoull(value) * MB;
+      } else if (key == "blob_compression") {
+        profile->blobCompression = parseCompression(value);
+      } else if (key == "blob_gc") {
+        profile->blobGC = std::stoi(value) != 0;
+      } else if (key == "blob_gc_age_cutoff") {
+        profile->blobGCAgeCutoff = std::stod(value);
+      } else {
+        throw std::invalid_argument("unknown option " + key);
+      }
+    } catch (const std::exception &e) {
+      *err = path + ":" + std::to_string(lineno) + ": " + e.what();
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,86 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_PROFILE_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_PROFILE_H_
+
+#include <string>
+#include <vector>
+#include <rocksdb/options.h>
+#include <rocksdb/table.h>
+
+enum FilterType : int {
+  NO_FILTER = 0,
+  BLOOM_FILTER = 1,
+  RIBBON_FILTER = 2,
+};
+
+// RocksDBProfile is the tunable part of the RocksDB options used by DiskKV,
+// the shared resources (block cache, memtable budget, rate limiter and thread
+// pool) are created once per process by SharedRocksDB
+struct RocksDBProfile {
+  // shared resources
+  size_t blockCacheBytes = 256 * 1024 * 1024;
+  size_t writeBufferManagerBytes = 256 * 1024 * 1024;
+  uint64_t rateLimitBytesPerSec = 0;
+  int backgroundThreads = 4;
+  // table options
+  size_t blockSize = 4 * 1024;
+  FilterType filter = BLOOM_FILTER;
+  double filterBitsPerKey = 10;
+  bool cacheIndexAndFilterBlocks = false;
+  bool dataBlockHashIndex = false;
+  // column family options
+  size_t writeBufferSize = 64 * 1024 * 1024;
+  int maxWriteBufferNumber = 2;
+  double memtableBloomRatio = 0;
+  rocksdb::CompactionStyle compactionStyle = rocksdb::kCompactionStyleLevel;
+  int level0CompactionTrigger = 4;
+  // the compression of levels not listed in compressionPerLevel,
+  // kDisableCompressionOption keeps the RocksDB default (snappy when compiled
+  // in), and for the bottommost level the compression of the other levels
+  rocksdb::CompressionType compression = rocksdb::kDisableCompressionOption;
+  rocksdb::CompressionType bottommostCompression =
+    rocksdb::kDisableCompressionOption;
+  std::vector<rocksdb::CompressionType> compressionPerLevel;
+  // integrated BlobDB, values of at least minBlobSize bytes are stored in
+  // blob files so compaction only rewrites the small references
+  bool enableBlobFiles = false;
+  uint64_t minBlobSize = 4 * 1024;
+  uint64_t blobFileSize = 256 * 1024 * 1024;
+  rocksdb::CompressionType blobCompression = rocksdb::kNoCompression;
+  bool blobGC = true;
+  // blob files in the oldest blobGCAgeCutoff fraction are relocated by
+  // compaction
+  double blobGCAgeCutoff = 0.25;
+
+  void Apply(
+    rocksdb::Options *opts,
+    rocksdb::BlockBasedTableOptions *table) const;
+  std::string ToString() const;
+};
+
+// presets: "default", "point-lookup", "write-heavy" and "large-value", returns
+// false if name is unknown
+bool GetRocksDBPreset(const std::string &name, RocksDBProfile *profile);
+
+// applies the "key = value" lines of the file at path on top of profile, '#'
+// starts a comment and a "preset = name" line resets profile to the preset,
+// returns false and sets err on failure
+bool LoadRocksDBProfile(
+  const std::string &path,
+  RocksDBProfile *profile,
+  std::string *err);
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_PROFILE_H_
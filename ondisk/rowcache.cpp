@@ -0,0 +1,173 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+#include <algorithm>
+#include "rowcache.h"
+
+// per entry overhead of the slot and the index
+constexpr size_t entryOverhead = sizeof(std::string) * 2 + 64;
+
+RowCache::RowCache(size_t capacityBytes, size_t shards)
+  : shardCapacity_(capacityBytes / std::max<size_t>(shards, 1)),
+    shards_(new Shard[std::max<size_t>(shards, 1)]),
+    numShards_(std::max<size_t>(shards, 1)), hits_(0), misses_(0),
+    inserts_(0), evictions_(0)
+{
+}
+
+RowCache::Shard &RowCache::shard(const rocksdb::Slice &key) const
+{
+  auto h = StringRefHash()(StringRef(key.data(), key.size()));
+  return shards_[(h >> 32) % numShards_];
+}
+
+bool RowCache::Get(
+  const rocksdb::Slice &key,
+  uint64_t now,
+  char **data,
+  size_t *size) const
+{
+  auto &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.mtx);
+  auto it = s.index.find(StringRef(key.data(), key.size()));
+  if (it == s.index.end()) {
+    misses_++;
+    return false;
+  }
+  auto &entry = s.entries[it->second];
+  if (entry.expiry != 0 && entry.expiry <= now) {
+    misses_++;
+    return false;
+  }
+  entry.referenced = true;
+  *size = entry.value.size();
+  *data = new char[*size];
+  memcpy(*data, entry.value.data(), *size);
+  hits_++;
+  return true;
+}
+
+uint64_t RowCache::Sequence(const rocksdb::Slice &key) const
+{
+  auto &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.mtx);
+  return s.seq;
+}
+
+void RowCache::evict(Shard &s, size_t i)
+{
+  auto &entry = s.entries[i];
+  s.index.erase(StringRef(entry.key));
+  s.bytes -= entry.key.size() + entry.value.size() + entryOverhead;
+  entry.used = false;
+  std::string().swap(entry.key);
+  std::string().swap(entry.value);
+  s.free.push_back(i);
+}
+
+void RowCache::Insert(
+  const rocksdb::Slice &key,
+  const rocksdb::Slice &value,
+  uint64_t expiry,
+  uint64_t seq)
+{
+  auto bytes = key.size() + value.size() + entryOverhead;
+  if (bytes > shardCapacity_) {
+    return;
+  }
+  auto &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.mtx);
+  if (s.seq != seq
+    || s.index.find(StringRef(key.data(), key.size())) != s.index.end()) {
+    return;
+  }
+  while (s.bytes + bytes > shardCapacity_) {
+    if (s.hand >= s.entries.size()) {
+      s.hand = 0;
+    }
+    auto &entry = s.entries[s.hand];
+    if (entry.used && entry.referenced) {
+      entry.referenced = false;
+    } else if (entry.used) {
+      evict(s, s.hand);
+      evictions_++;
+    }
+    s.hand++;
+  }
+  size_t i;
+  if (s.free.empty()) {
+    i = s.entries.size();
+    s.entries.emplace_back();
+  } else {
+    i = s.free.back();
+    s.free.pop_back();
+  }
+  auto &entry = s.entries[i];
+  entry.key.assign(key.data(), key.size());
+  entry.value.assign(value.data(), value.size());
+  entry.expiry = expiry;
+  entry.used = true;
+  entry.referenced = false;
+  s.index.emplace(StringRef(entry.key), i);
+  s.bytes += bytes;
+  inserts_++;
+}
+
+void RowCache::Erase(const rocksdb::Slice &key)
+{
+  auto &s = shard(key);
+  std::lock_guard<std::mutex> guard(s.mtx);
+  s.seq++;
+  auto it = s.index.find(StringRef(key.data(), key.size()));
+  if (it != s.index.end()) {
+    evict(s, it->second);
+  }
+}
+
+void RowCache::Clear()
+{
+  for (size_t i = 0; i < numShards_; ++i) {
+    auto &s = shards_[i];
+    std::lock_guard<std::mutex> guard(s.mtx);
+    s.seq++;
+    s.index.clear();
+    s.entries.clear();
+    s.free.clear();
+    s.hand = 0;
+    s.bytes = 0;
+  }
+}
+
+std::string RowCache::ToString() const
+{
+  size_t bytes = 0;
+  size_t entries = 0;
+  for (size_t i = 0; i < numShards_; ++i) {
+    auto &s = shards_[i];
+    std::lock_guard<std::mutex> guard(s.mtx);
+    bytes += s.bytes;
+    entries += s.index.size();
+  }
+  auto hits = hits_.load();
+  auto lookups = hits + misses_.load();
+  std::stringstream ss;
+  ss << "entries: " << entries << ", bytes: " << bytes
+     << ", hits: " << hits << ", misses: " << lookups - hits
+     << ", hit_rate: " << (lookups == 0 ? 0 : hits * 100 / lookups) << "%"
+     << ", inserts: " << inserts_.load()
+     << ", evictions: " << evictions_.load();
+  return ss.str();
+}
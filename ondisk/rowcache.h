@@ -0,0 +1,89 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_ROWCACHE_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_ROWCACHE_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <rocksdb/slice.h>
+#include "arena.h"
+
+// RowCache keeps recently read values of DiskKV in memory, split into shards
+// each evicting with CLOCK once over its share of the capacity.
+//
+// batchedUpdate erases the keys it writes before returning, so a lookup after
+// it never sees an older value. A lookup racing with it takes the Sequence of
+// the key before reading RocksDB and Insert drops the value if the key has
+// been erased since, so an older value read from RocksDB is never inserted
+// after the erase.
+class RowCache {
+ public:
+  explicit RowCache(size_t capacityBytes, size_t shards = 16);
+  // copies the value of key into a new[] buffer, returns false if key is not
+  // cached or expired at now
+  bool Get(
+    const rocksdb::Slice &key,
+    uint64_t now,
+    char **data,
+    size_t *size) const;
+  uint64_t Sequence(const rocksdb::Slice &key) const;
+  // caches the value read after Sequence returned seq, expiry is 0 for values
+  // without TTL
+  void Insert(
+    const rocksdb::Slice &key,
+    const rocksdb::Slice &value,
+    uint64_t expiry,
+    uint64_t seq);
+  void Erase(const rocksdb::Slice &key);
+  void Clear();
+  std::string ToString() const;
+ private:
+  struct Entry {
+    std::string key;
+    std::string value;
+    uint64_t expiry;
+    bool used;
+    // set by Get, cleared by the CLOCK hand before evicting
+    mutable bool referenced;
+  };
+  struct Shard {
+    mutable std::mutex mtx;
+    // entries are never moved so that the map can refer to their keys
+    std::deque<Entry> entries;
+    std::vector<size_t> free;
+    std::unordered_map<StringRef, size_t, StringRefHash> index;
+    size_t hand = 0;
+    size_t bytes = 0;
+    // bumped by Erase and Clear
+    uint64_t seq = 0;
+  };
+  Shard &shard(const rocksdb::Slice &key) const;
+  void evict(Shard &shard, size_t i);
+  const size_t shardCapacity_;
+  std::unique_ptr<Shard[]> shards_;
+  const size_t numShards_;
+  mutable std::atomic<uint64_t> hits_;
+  mutable std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> inserts_;
+  std::atomic<uint64_t> evictions_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_ROWCACHE_H_
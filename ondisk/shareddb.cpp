@@ -0,0 +1,167 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <stdexcept>
+#include "shareddb.h"
+#include "zupply.hpp"
+
+SharedRocksDB::SharedRocksDB(
+  const SharedDBOptions &options,
+  const RocksDBProfile &profile)
+  : options_(options),
+    cache_(rocksdb::NewLRUCache(profile.blockCacheBytes)),
+    wbm_(std::make_shared<rocksdb::WriteBufferManager>(
+      profile.writeBufferManagerBytes, cache_)),
+    ttlFilter_(std::make_shared<TTLFilterFactory>())
+{
+  if (profile.rateLimitBytesPerSec != 0) {
+    limiter_.reset(
+      rocksdb::NewGenericRateLimiter(profile.rateLimitBytesPerSec));
+  }
+  rocksdb::Env::Default()->SetBackgroundThreads(
+    profile.backgroundThreads, rocksdb::Env::LOW);
+  rocksdb::Env::Default()->SetBackgroundThreads(1, rocksdb::Env::HIGH);
+}
+
+SharedRocksDB::~SharedRocksDB()
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  if (!db_) {
+    return;
+  }
+  for (auto &item : handles_) {
+    db_->DestroyColumnFamilyHandle(item.second);
+  }
+  handles_.clear();
+  db_->Close();
+}
+
+bool SharedRocksDB::SingleDB() const noexcept
+{
+  return options_.singleDB;
+}
+
+void SharedRocksDB::Configure(
+  rocksdb::Options *opts,
+  rocksdb::BlockBasedTableOptions *table) const
+{
+  opts->env = rocksdb::Env::Default();
+  opts->write_buffer_manager = wbm_;
+  opts->rate_limiter = limiter_;
+  table->block_cache = cache_;
+}
+
+std::shared_ptr<TTLFilterFactory> SharedRocksDB::TTLFilter() const
+{
+  return ttlFilter_;
+}
+
+void SharedRocksDB::Open(const rocksdb::Options &opts)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  if (db_) {
+    return;
+  }
+  if (!zz::os::create_directory_recursive(options_.dir)) {
+    throw std::runtime_error("failed to create shared db dir");
+  }
+  std::vector<std::string> names;
+  auto s = rocksdb::DB::ListColumnFamilies(opts, options_.dir, &names);
+  if (!s.ok()) {
+    // a new DB
+    names = {rocksdb::kDefaultColumnFamilyName};
+  }
+  std::vector<rocksdb::ColumnFamilyDescriptor> descriptors;
+  for (auto &name : names) {
+    descriptors.emplace_back(name, opts);
+  }
+  auto dbopts = opts;
+  dbopts.create_if_missing = true;
+  dbopts.create_missing_column_families = true;
+  std::vector<rocksdb::ColumnFamilyHandle *> handles;
+  rocksdb::DB *db = nullptr;
+  s = rocksdb::DB::Open(dbopts, options_.dir, descriptors, &handles, &db);
+  if (!s.ok()) {
+    throw std::runtime_error("failed to open shared RocksDB: " + s.ToString());
+  }
+  db_.reset(db);
+  for (auto handle : handles) {
+    handles_[handle->GetName()] = handle;
+  }
+}
+
+std::shared_ptr<rocksdb::DB> SharedRocksDB::DB() const
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  return db_;
+}
+
+rocksdb::ColumnFamilyHandle *SharedRocksDB::GetColumnFamily(
+  const std::string &name,
+  const rocksdb::Options &opts)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  if (!db_) {
+    throw std::runtime_error("shared RocksDB not opened");
+  }
+  auto it = handles_.find(name);
+  if (it != handles_.end()) {
+    return it->second;
+  }
+  rocksdb::ColumnFamilyHandle *handle = nullptr;
+  auto s = db_->CreateColumnFamily(opts, name, &handle);
+  if (!s.ok()) {
+    throw std::runtime_error("failed to create column family: " + s.ToString());
+  }
+  handles_[name] = handle;
+  return handle;
+}
+
+bool SharedRocksDB::HasColumnFamily(const std::string &name) const
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  return handles_.find(name) != handles_.end();
+}
+
+std::vector<std::string> SharedRocksDB::ListColumnFamilies(
+  const std::string &prefix) const
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  std::vector<std::string> names;
+  for (auto &item : handles_) {
+    if (item.first.compare(0, prefix.size(), prefix) == 0) {
+      names.push_back(item.first);
+    }
+  }
+  return names;
+}
+
+void SharedRocksDB::DropColumnFamily(const std::string &name)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  auto it = handles_.find(name);
+  if (it == handles_.end()) {
+    return;
+  }
+  auto s = db_->DropColumnFamily(it->second);
+  if (!s.ok()) {
+    std::cerr
+      << "failed to drop column family " << name << ": "
+      << s.ToString() << std::endl;
+    return;
+  }
+  db_->DestroyColumnFamilyHandle(it->second);
+  handles_.erase(it);
+}
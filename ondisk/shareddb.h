@@ -0,0 +1,80 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_SHAREDDB_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_SHAREDDB_H_
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <rocksdb/db.h>
+#include <rocksdb/cache.h>
+#include <rocksdb/write_buffer_manager.h>
+#include <rocksdb/rate_limiter.h>
+#include "profile.h"
+#include "ttlfilter.h"
+
+struct SharedDBOptions {
+  // all DiskKV instances share one RocksDB located in dir, each instance owns
+  // a column family named after its db dir
+  bool singleDB = false;
+  std::string dir = "example-data/shared";
+};
+
+// SharedRocksDB holds the RocksDB resources shared by all DiskKV instances of
+// a NodeHost: block cache, WriteBufferManager (the memtable budget, charged to
+// the block cache), compaction rate limiter, Env thread pool and, when
+// SharedDBOptions::singleDB is set, the RocksDB itself, all methods are thread
+// safe
+class SharedRocksDB {
+ public:
+  SharedRocksDB(
+    const SharedDBOptions &options,
+    const RocksDBProfile &profile);
+  ~SharedRocksDB();
+  bool SingleDB() const noexcept;
+  // sets the shared resources on opts and table
+  void Configure(
+    rocksdb::Options *opts,
+    rocksdb::BlockBasedTableOptions *table) const;
+  // opens the shared RocksDB with all its column families if not opened yet,
+  // existing column families are opened with the column family part of opts
+  void Open(const rocksdb::Options &opts);
+  std::shared_ptr<rocksdb::DB> DB() const;
+  // returns the handle of the column family, creates it if not exists, the
+  // handle is owned by SharedRocksDB and valid until DropColumnFamily
+  rocksdb::ColumnFamilyHandle *GetColumnFamily(
+    const std::string &name,
+    const rocksdb::Options &opts);
+  bool HasColumnFamily(const std::string &name) const;
+  // returns the names of all column families starting with prefix
+  std::vector<std::string> ListColumnFamilies(const std::string &prefix) const;
+  void DropColumnFamily(const std::string &name);
+  // the TTL filter factory shared by all column families of the single DB,
+  // each DiskKV registers the GC horizon of its own column family
+  std::shared_ptr<TTLFilterFactory> TTLFilter() const;
+ private:
+  const SharedDBOptions options_;
+  std::shared_ptr<rocksdb::Cache> cache_;
+  std::shared_ptr<rocksdb::WriteBufferManager> wbm_;
+  std::shared_ptr<rocksdb::RateLimiter> limiter_;
+  std::shared_ptr<TTLFilterFactory> ttlFilter_;
+  mutable std::mutex mtx_;
+  std::shared_ptr<rocksdb::DB> db_;
+  std::unordered_map<std::string, rocksdb::ColumnFamilyHandle *> handles_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_SHAREDDB_H_
@@ -0,0 +1,172 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <algorithm>
+#include "snapshotscanner.h"
+
+SnapshotScanner::SnapshotScanner(
+  rocksdb::DB *db,
+  rocksdb::ColumnFamilyHandle *cf,
+  const rocksdb::ReadOptions &ro,
+  std::vector<std::string> boundaries,
+  size_t threads,
+  size_t chunkBytes,
+  size_t bufferedChunks,
+  TokenBucket *limiter)
+  : db_(db), cf_(cf), ro_(ro), boundaries_(std::move(boundaries)),
+    chunkBytes_(chunkBytes),
+    bufferedChunks_(std::max<size_t>(bufferedChunks, 1)),
+    window_(2 * std::max<size_t>(threads, 1)), limiter_(limiter),
+    ranges_(boundaries_.size() + 1), next_(0), current_(0), stopped_(false)
+{
+  threads = std::min(std::max<size_t>(threads, 1), ranges_.size());
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(&SnapshotScanner::work, this);
+  }
+}
+
+SnapshotScanner::~SnapshotScanner()
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+bool SnapshotScanner::Next(std::string *chunk)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (current_ < ranges_.size()) {
+    if (!status_.ok()) {
+      return false;
+    }
+    auto &range = ranges_[current_];
+    if (!range.chunks.empty()) {
+      chunk->swap(range.chunks.front());
+      range.chunks.pop_front();
+      lock.unlock();
+      cv_.notify_all();
+      return true;
+    }
+    if (range.done) {
+      ++current_;
+      cv_.notify_all();
+      continue;
+    }
+    cv_.wait(lock);
+  }
+  return false;
+}
+
+rocksdb::Status SnapshotScanner::Status() const
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  return status_;
+}
+
+void SnapshotScanner::work()
+{
+  for (;;) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [this]()
+      {
+        return stopped_ || next_ >= ranges_.size()
+          || next_ < current_ + window_;
+      });
+      if (stopped_ || next_ >= ranges_.size()) {
+        return;
+      }
+      index = next_++;
+    }
+    scan(index);
+  }
+}
+
+void SnapshotScanner::scan(size_t index)
+{
+  auto ro = ro_;
+  rocksdb::Slice lower, upper;
+  if (index > 0) {
+    lower = boundaries_[index - 1];
+    ro.iterate_lower_bound = &lower;
+  }
+  if (index < boundaries_.size()) {
+    upper = boundaries_[index];
+    ro.iterate_upper_bound = &upper;
+  }
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(ro, cf_));
+  std::string chunk;
+  auto appendLen = [&chunk](uint64_t len)
+  {
+    chunk.append(reinterpret_cast<const char *>(&len), sizeof(uint64_t));
+  };
+  if (index > 0) {
+    iter->Seek(lower);
+  } else {
+    iter->SeekToFirst();
+  }
+  for (; iter->Valid(); iter->Next()) {
+    auto key = iter->key();
+    auto val = iter->value();
+    appendLen(key.size());
+    chunk.append(key.data(), key.size());
+    appendLen(val.size());
+    chunk.append(val.data(), val.size());
+    if (chunk.size() >= chunkBytes_) {
+      if (limiter_ != nullptr) {
+        limiter_->Request(chunk.size());
+      }
+      if (!push(index, &chunk)) {
+        return;
+      }
+    }
+  }
+  if (limiter_ != nullptr && !chunk.empty()) {
+    limiter_->Request(chunk.size());
+  }
+  std::lock_guard<std::mutex> guard(mtx_);
+  if (!iter->status().ok()) {
+    status_ = iter->status();
+  } else if (!chunk.empty()) {
+    ranges_[index].chunks.push_back(std::move(chunk));
+  }
+  ranges_[index].done = true;
+  cv_.notify_all();
+}
+
+bool SnapshotScanner::push(size_t index, std::string *chunk)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  // ranges are claimed in order, so the range being returned is either done
+  // or scanned by a worker which is only waiting for Next to drain it
+  cv_.wait(lock, [this, index]()
+  {
+    return stopped_ || !status_.ok()
+      || ranges_[index].chunks.size() < bufferedChunks_;
+  });
+  if (stopped_ || !status_.ok()) {
+    return false;
+  }
+  ranges_[index].chunks.push_back(std::move(*chunk));
+  chunk->clear();
+  cv_.notify_all();
+  return true;
+}
@@ -0,0 +1,75 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_SNAPSHOTSCANNER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_SNAPSHOTSCANNER_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <rocksdb/db.h>
+#include "tokenbucket.h"
+
+// SnapshotScanner scans the key ranges split by boundaries of a RocksDB
+// snapshot on worker threads and returns the encoded records in key order,
+// at most window ranges ahead of the one being returned are scanned and each
+// of them buffers at most bufferedChunks chunks, the scan is throttled by
+// limiter unless it is nullptr
+class SnapshotScanner {
+ public:
+  SnapshotScanner(
+    rocksdb::DB *db,
+    rocksdb::ColumnFamilyHandle *cf,
+    const rocksdb::ReadOptions &ro,
+    std::vector<std::string> boundaries,
+    size_t threads,
+    size_t chunkBytes,
+    size_t bufferedChunks,
+    TokenBucket *limiter);
+  ~SnapshotScanner();
+  // sets chunk to the next (keylen, key, vallen, val) records, returns false
+  // once all ranges are returned or a scan failed
+  bool Next(std::string *chunk);
+  rocksdb::Status Status() const;
+ private:
+  struct Range {
+    std::deque<std::string> chunks;
+    bool done = false;
+  };
+  void work();
+  void scan(size_t index);
+  // blocks until chunk of range index can be buffered, false if stopped
+  bool push(size_t index, std::string *chunk);
+  rocksdb::DB *db_;
+  rocksdb::ColumnFamilyHandle *cf_;
+  const rocksdb::ReadOptions ro_;
+  const std::vector<std::string> boundaries_;
+  const size_t chunkBytes_;
+  const size_t bufferedChunks_;
+  const size_t window_;
+  TokenBucket *limiter_;
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::vector<Range> ranges_;
+  size_t next_;
+  size_t current_;
+  bool stopped_;
+  rocksdb::Status status_;
+  std::vector<std::thread> workers_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_SNAPSHOTSCANNER_H_
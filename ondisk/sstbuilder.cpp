@@ -0,0 +1,130 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <algorithm>
+#include <rocksdb/env.h>
+#include <rocksdb/sst_file_writer.h>
+#include "sstbuilder.h"
+#include "zupply.hpp"
+
+SstBuilder::SstBuilder(
+  const rocksdb::Options &opts,
+  rocksdb::ColumnFamilyHandle *cf,
+  std::string dir,
+  size_t threads)
+  : opts_(opts), cf_(cf), dir_(std::move(dir)),
+    maxPending_(std::max<size_t>(threads, 1)), building_(0), finished_(false)
+{
+  for (size_t i = 0; i < maxPending_; ++i) {
+    workers_.emplace_back(&SstBuilder::work, this);
+  }
+}
+
+SstBuilder::~SstBuilder()
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    finished_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+bool SstBuilder::Add(std::string run)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  cv_.wait(lock, [this]()
+  {
+    return !status_.ok() || pending_.size() < maxPending_;
+  });
+  if (!status_.ok()) {
+    return false;
+  }
+  auto file = zz::os::path_join({dir_, std::to_string(files_.size()) + ".sst"});
+  files_.push_back(file);
+  pending_.emplace_back(std::move(file), std::move(run));
+  cv_.notify_all();
+  return true;
+}
+
+rocksdb::Status SstBuilder::Finish(std::vector<std::string> *files)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  finished_ = true;
+  cv_.notify_all();
+  cv_.wait(lock, [this]()
+  {
+    return (pending_.empty() && building_ == 0) || !status_.ok();
+  });
+  if (status_.ok()) {
+    *files = files_;
+  }
+  return status_;
+}
+
+void SstBuilder::work()
+{
+  for (;;) {
+    std::pair<std::string, std::string> run;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [this]()
+      {
+        return finished_ || !pending_.empty() || !status_.ok();
+      });
+      if (pending_.empty() || !status_.ok()) {
+        return;
+      }
+      run = std::move(pending_.front());
+      pending_.pop_front();
+      building_++;
+      cv_.notify_all();
+    }
+    auto s = build(run.second, run.first);
+    std::lock_guard<std::mutex> guard(mtx_);
+    building_--;
+    if (!s.ok() && status_.ok()) {
+      status_ = s;
+    }
+    cv_.notify_all();
+  }
+}
+
+rocksdb::Status SstBuilder::build(
+  const std::string &run,
+  const std::string &file)
+{
+  rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), opts_, cf_);
+  auto s = writer.Open(file);
+  if (!s.ok()) {
+    return s;
+  }
+  uint64_t len = 0;
+  for (size_t pos = 0; pos < run.size();) {
+    memcpy(&len, run.data() + pos, sizeof(uint64_t));
+    rocksdb::Slice key(run.data() + pos + sizeof(uint64_t), len);
+    pos += sizeof(uint64_t) + len;
+    memcpy(&len, run.data() + pos, sizeof(uint64_t));
+    rocksdb::Slice val(run.data() + pos + sizeof(uint64_t), len);
+    pos += sizeof(uint64_t) + len;
+    s = writer.Put(key, val);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return writer.Finish();
+}
@@ -0,0 +1,60 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_SSTBUILDER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_SSTBUILDER_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <rocksdb/db.h>
+
+// SstBuilder writes runs of sorted (keylen, key, vallen, val) records to SST
+// files in dir on worker threads, the runs are added in key order and must
+// not overlap so that all files can be ingested at once
+class SstBuilder {
+ public:
+  SstBuilder(
+    const rocksdb::Options &opts,
+    rocksdb::ColumnFamilyHandle *cf,
+    std::string dir,
+    size_t threads);
+  ~SstBuilder();
+  // queues run, blocks while as many runs as threads are pending, returns
+  // false if a previous run failed
+  bool Add(std::string run);
+  // waits for all runs and returns the SST files in key order
+  rocksdb::Status Finish(std::vector<std::string> *files);
+ private:
+  void work();
+  rocksdb::Status build(const std::string &run, const std::string &file);
+  const rocksdb::Options opts_;
+  rocksdb::ColumnFamilyHandle *cf_;
+  const std::string dir_;
+  const size_t maxPending_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  // pending runs and their files
+  std::deque<std::pair<std::string, std::string>> pending_;
+  std::vector<std::string> files_;
+  size_t building_;
+  bool finished_;
+  rocksdb::Status status_;
+  std::vector<std::thread> workers_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_SSTBUILDER_H_
@@ -14,53 +14,187 @@
 
 #include <chrono>
 #include <random>
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <sstream>
 #include <rocksdb/db.h>
+#include <rocksdb/table.h>
 #include "statemachine.h"
+#include "applybatch.h"
+#include "mergeoperator.h"
+#include "value.h"
+#include "snapshotscanner.h"
+#include "sstbuilder.h"
+#include "manifest.h"
+#include "proposalbatcher.h"
+#include "stalereader.h"
 #include "zupply.hpp"
 
 RocksDB::~RocksDB()
 {
-  if (db_) {
+  if (shared_) {
+    if (obsolete_) {
+      shared_->DropColumnFamily(name_);
+    }
+  } else if (db_) {
     db_->Close();
+    db_.reset();
+    if (obsolete_ && !trash_->Add(name_)) {
+      zz::os::remove_all(name_);
+    }
   }
 }
 
-DiskKV::DiskKV(uint64_t clusterID, uint64_t nodeID) noexcept
-  : dragonboat::OnDiskStateMachine(clusterID, nodeID)
+static uint64_t nowMicros() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowNanos() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a storage error is local to this replica, reporting it as the status of a
+// command or skipping the entry would let the replicas diverge, so the node
+// stops and replays the entries after the persisted applied index on restart
+[[noreturn]] static void updateFailed(
+  uint64_t index,
+  const rocksdb::Status &s) noexcept
+{
+  std::cerr
+    << "failed to update at index " << index << ": " << s.ToString()
+    << std::endl;
+  std::abort();
+}
+
+static CommandStatus applyCommand(
+  ApplyBatch *batch,
+  const char *data,
+  size_t size,
+  uint64_t index,
+  Command *cmd)
+{
+  if (!parseCommand(data, size, cmd)) {
+    return STATUS_INVALID_COMMAND;
+  }
+  CommandStatus status;
+  auto s = batch->Apply(*cmd, &status);
+  if (!s.ok()) {
+    updateFailed(index, s);
+  }
+  return status;
+}
+
+static WatchEventType watchEventType(ChangeType type) noexcept
+{
+  switch (type) {
+    case CHANGE_DELETE:
+      return WATCH_DELETE;
+    case CHANGE_DELETE_RANGE:
+      return WATCH_DELETE_RANGE;
+    case CHANGE_MERGE:
+      return WATCH_MERGE;
+    default:
+      return WATCH_PUT;
+  }
+}
+
+struct SnapshotContext {
+  const rocksdb::Snapshot *snapshot;
+  uint64_t pinnedTime;
+};
+
+std::string BatchStats::ToString() const
+{
+  std::stringstream ss;
+  ss << "entries: " << entries.ToString() << "\n"
+     << "bytes: " << bytes.ToString() << "\n"
+     << "build_us: " << buildMicros.ToString() << "\n"
+     << "write_us: " << writeMicros.ToString() << "\n"
+     << "syncs: " << syncs.load(std::memory_order_relaxed);
+  return ss.str();
+}
+
+DiskKV::DiskKV(
+  uint64_t clusterID,
+  uint64_t nodeID,
+  const DiskKVOptions &options) noexcept
+  : dragonboat::OnDiskStateMachine(clusterID, nodeID),
+    options_(options), lastApplied_(0), unsyncedBytes_(0), unsyncedSince_(0),
+    appliedTime_(0), ttlInUse_(false),
+    ownTTLFilter_(std::make_shared<TTLFilterFactory>()),
+    gcHorizon_(std::make_shared<std::atomic<uint64_t>>(0)), openMicros_(0),
+    trash_(options.trash), stopFilterBuild_(false), bloomNegatives_(0),
+    bloomFalsePositives_(0),
+    rowCache_(options.rowCacheBytes == 0
+      ? nullptr : new RowCache(options.rowCacheBytes))
 {
 }
 
 DiskKV::~DiskKV()
 {
+  stopFilterBuild();
+  if (rocks_) {
+    ttlFilter()->Unregister(rocks_->cf_->GetID());
+  }
 }
 
 OpenResult DiskKV::open(const dragonboat::DoneChan &done) noexcept
 {
   OpenResult r;
+  r.result = 0;
+  r.errcode = -1;
+  auto start = nowMicros();
   auto dir = getNodeDBDirName(cluster_id_, node_id_);
   createNodeDataDir(dir);
-  std::string dbdir;
+  if (!trash_) {
+    trash_ = std::make_shared<TrashReclaimer>(dir + "_trash", 0);
+  }
+  if (options_.shared && options_.shared->SingleDB()) {
+    options_.shared->Open(createOptions());
+  }
+  DBManifest manifest;
   if (!isNewRun(dir)) {
-    cleanupNodeDataDir(dir);
-    dbdir = getCurrentDBDirName(dir);
-    if (!zz::os::is_directory(dbdir)) {
-      std::cerr << "db dir unexpectedly deleted" << std::endl;
-      r.result = 0;
-      r.errcode = -1;
+    zz::os::remove_all(zz::os::path_join({dir, updatingDBFilename}));
+    auto manifests = loadManifests(dir);
+    auto it = std::find_if(
+      manifests.begin(), manifests.end(),
+      [this](const DBManifest &m) { return dbExists(m.dbdir); });
+    if (it == manifests.end()) {
+      std::cerr << "no valid manifest or db dir in " << dir << std::endl;
       return r;
     }
+    if (it != manifests.begin()) {
+      std::cerr << "falling back to the previous manifest" << std::endl;
+    }
+    manifest = *it;
+    cleanupNodeDataDir(dir, manifest.dbdir);
   } else {
-    dbdir = getNewRandomDBDirName(dir);
-    saveCurrentDBDirName(dir, dbdir);
-    replaceCurrentDBFile(dir);
+    manifest.dbdir = getNewRandomDBDirName(dir);
+    saveManifest(dir, manifest);
   }
-  auto rocks = createDB(dbdir);
+  auto rocks = createDB(manifest.dbdir);
   {
     std::lock_guard<std::mutex> guard(mtx_);
     rocks_.swap(rocks);
   }
   lastApplied_ = queryAppliedIndex(rocks_.get());
+  if (lastApplied_ < manifest.appliedIndex) {
+    std::cerr
+      << "applied index " << lastApplied_ << " behind the manifest "
+      << manifest.appliedIndex << std::endl;
+    return r;
+  }
+  loadTTLState(rocks_.get());
+  startFilterBuild(rocks_);
+  openMicros_ = nowMicros() - start;
+  std::cout
+    << "opened " << manifest.dbdir << " at index " << lastApplied_
+    << " in " << openMicros_ / 1000 << "ms" << std::endl;
   r.result = lastApplied_;
   r.errcode = 0;
   return r;
@@ -73,56 +207,223 @@ void DiskKV::batchedUpdate(std::vector<dragonboat::Entry> &ents) noexcept
     std::lock_guard<std::mutex> guard(mtx_);
     rocks = rocks_;
   }
-  auto wb = rocksdb::WriteBatch();
+  auto start = nowMicros();
+  ApplyBatch batch(rocks.get(), appliedTime_, ttlInUse_);
+  Command cmd;
+  std::vector<std::string> batched;
   for (auto &ent : ents) {
-    std::stringstream ss({reinterpret_cast<const char *>(ent.cmd), ent.cmdLen});
-    std::string key, value;
-    ss >> key >> value;
-    wb.Put(key, value);
-    ent.result = ent.index;
-  }
-  wb.Put(appliedIndexKey, std::to_string(ents.back().index));
-  auto s = rocks->db_->Write(rocks->wo_, &wb);
+    auto data = reinterpret_cast<const char *>(ent.cmd);
+    if (!isBatch(data, ent.cmdLen)) {
+      ent.result = applyCommand(&batch, data, ent.cmdLen, ent.index, &cmd);
+    } else if (!decodeBatch(
+      data, ent.cmdLen, maxBatchCommands(statusBits), &batched)) {
+      ent.result = 0;
+      for (size_t i = 0; i < maxBatchCommands(statusBits); ++i) {
+        ent.result = packBatchResult(
+          ent.result, i, statusBits, STATUS_INVALID_COMMAND);
+      }
+    } else {
+      ent.result = 0;
+      for (size_t i = 0; i < batched.size(); ++i) {
+        auto &c = batched[i];
+        ent.result = packBatchResult(
+          ent.result, i, statusBits,
+          applyCommand(&batch, c.data(), c.size(), ent.index, &cmd));
+      }
+    }
+    batch.SetAppliedIndex(ent.index);
+  }
+  auto built = nowMicros();
+  uint64_t size = batch.Bytes();
+  auto wo = rocks->wo_;
+  if (options_.coalesceBytes != 0) {
+    auto since = unsyncedSince_.load();
+    wo.sync = unsyncedBytes_.load() + size >= options_.coalesceBytes
+      || (since != 0 && built - since >= options_.coalesceMicros);
+  }
+  rocksdb::Status s;
+  bool saturated = false;
+  if (options_.bloomBitsPerKey != 0) {
+    std::lock_guard<std::mutex> guard(filterMtx_);
+    auto filter = std::atomic_load(&rocks->filter_);
+    for (auto &change : batch.Changes()) {
+      if (change.type != CHANGE_PUT && change.type != CHANGE_MERGE) {
+        continue;
+      }
+      if (filter) {
+        filter->Add(change.key.data(), change.key.size());
+      }
+      if (building_) {
+        building_->Add(change.key.data(), change.key.size());
+      }
+    }
+    s = batch.Write(wo);
+    saturated = filter && filter->Saturated() && !building_;
+  } else {
+    s = batch.Write(wo);
+  }
   if (!s.ok()) {
-    std::cerr << "failed to update: " << s.ToString() << std::endl;
+    updateFailed(ents.empty() ? lastApplied_.load() : ents.back().index, s);
+  }
+  if (!ents.empty()) {
+    lastApplied_ = ents.back().index;
+  }
+  if (rowCache_) {
+    // before returning so that no later lookup sees the old values
+    for (auto &change : batch.Changes()) {
+      if (change.type == CHANGE_DELETE_RANGE) {
+        rowCache_->Clear();
+        break;
+      }
+      rowCache_->Erase(change.key);
+    }
+  }
+  if (options_.watch && options_.watch->Active()) {
+    for (auto &change : batch.Changes()) {
+      options_.watch->Publish(
+        {change.index, watchEventType(change.type), change.key, change.value});
+    }
+  }
+  if (saturated) {
+    startFilterBuild(rocks);
+  }
+  auto written = nowMicros();
+  ttlInUse_ = batch.TTLInUse();
+  if (batch.AppliedTime() != appliedTime_) {
+    appliedTime_ = batch.AppliedTime();
+    updateGCHorizon();
   }
+  if (wo.sync) {
+    unsyncedBytes_ = 0;
+    unsyncedSince_ = 0;
+    stats_.syncs++;
+  } else {
+    unsyncedBytes_ += size;
+    uint64_t expected = 0;
+    unsyncedSince_.compare_exchange_strong(expected, built);
+  }
+  stats_.entries.Record(ents.size());
+  stats_.bytes.Record(size);
+  stats_.buildMicros.Record(built - start);
+  stats_.writeMicros.Record(written - built);
 }
 
 LookupResult DiskKV::lookup(
   const dragonboat::Byte *data,
   size_t size) const noexcept
 {
+  LookupResult r;
   std::shared_ptr<RocksDB> rocks;
   {
     std::lock_guard<std::mutex> guard(mtx_);
     rocks = rocks_;
   }
-  std::string value;
-  auto s = rocks->db_->Get(
-    rocks->ro_,
-    {reinterpret_cast<const char *>(data), size},
-    &value);
-  LookupResult r;
-  if (!s.ok()) {
+  if (size == statsQuery.size()
+    && memcmp(data, statsQuery.data(), size) == 0) {
+    auto str = getStats(rocks.get());
+    r.size = str.size();
+    r.result = new char[r.size];
+    memcpy(r.result, str.data(), r.size);
+    return r;
+  }
+  if (size == ttlInUseQuery.size()
+    && memcmp(data, ttlInUseQuery.data(), size) == 0) {
+    r.size = 1;
+    r.result = new char[r.size];
+    r.result[0] = ttlInUse_ ? '1' : '0';
+    return r;
+  }
+  if (size == appliedQuery.size()
+    && memcmp(data, appliedQuery.data(), size) == 0) {
+    auto str = encodeAppliedState({lastApplied_, appliedTime_});
+    r.size = str.size();
+    r.result = new char[r.size];
+    memcpy(r.result, str.data(), r.size);
+    return r;
+  }
+  auto start = nowNanos();
+  rocksdb::Slice key(reinterpret_cast<const char *>(data), size);
+  uint64_t seq = 0;
+  if (rowCache_) {
+    if (rowCache_->Get(key, appliedTime_, &r.result, &r.size)) {
+      cacheHitNanos_.Record(nowNanos() - start);
+      return r;
+    }
+    seq = rowCache_->Sequence(key);
+  }
+  auto filter = std::atomic_load(&rocks->filter_);
+  if (filter && !filter->MayContain(key.data(), key.size())) {
+    bloomNegatives_++;
+    r.result = nullptr;
+    r.size = 0;
+    return r;
+  }
+  std::string stored;
+  auto s = rocks->db_->Get(rocks->ro_, rocks->cf_, key, &stored);
+  if (s.IsNotFound()) {
+    if (filter) {
+      bloomFalsePositives_++;
+    }
+    r.result = nullptr;
+    r.size = 0;
+    return r;
+  } else if (!s.ok()) {
     std::cerr << "failed to lookup: " << s.ToString() << std::endl;
     r.result = nullptr;
     r.size = 0;
     return r;
   }
-  if (value.empty()) {
+  rocksdb::Slice value;
+  uint64_t expiry = 0;
+  if (!decodeValue(stored, &value, &expiry)) {
+    std::cerr << "failed to lookup: invalid value header" << std::endl;
+    value.clear();
+  }
+  if (value.empty() || isExpired(expiry, appliedTime_)) {
     r.result = nullptr;
     r.size = 0;
   } else {
-    r.size = value.length();
+    r.size = value.size();
     r.result = new char[r.size];
     memcpy(r.result, value.data(), r.size);
+    if (rowCache_) {
+      // rocks may have been replaced by recoverFromSnapshot after seq was
+      // taken, its values must not outlive the Clear that follows the swap
+      bool current;
+      {
+        std::lock_guard<std::mutex> guard(mtx_);
+        current = rocks_ == rocks;
+      }
+      if (current) {
+        rowCache_->Insert(key, value, expiry, seq);
+      }
+    }
   }
+  dbLookupNanos_.Record(nowNanos() - start);
   return r;
 }
 
 int DiskKV::sync() const noexcept
 {
-  // FIXME: use fsync here
+  auto since = unsyncedSince_.load();
+  if (since == 0) {
+    return 0;
+  }
+  std::shared_ptr<RocksDB> rocks;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    rocks = rocks_;
+  }
+  auto s = rocks->db_->SyncWAL();
+  if (!s.ok()) {
+    std::cerr << "failed to sync: " << s.ToString() << std::endl;
+    return -1;
+  }
+  // skip the reset if batchedUpdate has synced and started a new unsynced run
+  // in the meantime
+  if (unsyncedSince_.compare_exchange_strong(since, 0)) {
+    unsyncedBytes_ = 0;
+  }
   return 0;
 }
 
@@ -134,14 +435,16 @@ uint64_t DiskKV::getHash() const noexcept
 
 PrepareSnapshotResult DiskKV::prepareSnapshot() const noexcept
 {
-  std::shared_ptr<RocksDB> rocks;
+  auto ctx = new SnapshotContext;
   {
     std::lock_guard<std::mutex> guard(mtx_);
-    rocks = rocks_;
+    ctx->snapshot = rocks_->db_->GetSnapshot();
+    ctx->pinnedTime = appliedTime_;
+    pinnedTimes_.insert(ctx->pinnedTime);
   }
-  auto snapshotptr = rocks->db_->GetSnapshot();
+  updateGCHorizon();
   PrepareSnapshotResult r;
-  r.result = (void *)snapshotptr;
+  r.result = ctx;
   r.errcode = SNAPSHOT_OK;
   return r;
 }
@@ -158,82 +461,233 @@ SnapshotResult DiskKV::saveSnapshot(
   }
   SnapshotResult r;
   r.size = 0;
-  auto snapshotptr = reinterpret_cast<const rocksdb::Snapshot *>(context);
+  r.errcode = SNAPSHOT_OK;
+  std::unique_ptr<const SnapshotContext> ctx(
+    reinterpret_cast<const SnapshotContext *>(context));
   auto ro = rocksdb::ReadOptions();
-  ro.snapshot = snapshotptr;
-  rocksdb::Iterator *iter = rocks->db_->NewIterator(ro);
-  uint64_t count = 0;
-  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-    count++;
+  ro.snapshot = ctx->snapshot;
+  // keep the blocks used by lookup cached
+  ro.fill_cache = false;
+  ro.readahead_size = options_.snapshotReadaheadBytes;
+  // each range is scanned in a single pass, values stored in blob files are
+  // read once, and the ranges are written in key order
+  std::unique_ptr<SnapshotScanner> scanner(new SnapshotScanner(
+    rocks->db_.get(), rocks->cf_, ro, snapshotBoundaries(rocks.get()),
+    options_.snapshotThreads, snapshotBufferSize, 2,
+    options_.snapshotLimiter.get()));
+  SnapshotStreamWriter stream(
+    [writer](const char *data, size_t size) -> bool
+    {
+      auto ioret = writer->Write(
+        reinterpret_cast<const dragonboat::Byte *>(data), size);
+      if (ioret.error != 0) {
+        std::cerr
+          << "failed to save snapshot: "
+          << std::to_string(ioret.error) << std::endl;
+        return false;
+      }
+      return true;
+    }, options_.snapshotCodec);
+  uint64_t markerValue = snapshotStreamMarker;
+  auto marker = reinterpret_cast<const char *>(&markerValue);
+  if (!stream.Write(marker, sizeof(uint64_t))) {
+    r.errcode = FAILED_TO_SAVE_SNAPSHOT;
   }
-  auto ioret = writer->Write(
-    reinterpret_cast<dragonboat::Byte *>(&count), sizeof(uint64_t));
-  if (ioret.error != 0) {
+  std::string chunk;
+  while (r.errcode == SNAPSHOT_OK && scanner->Next(&chunk)) {
+    if (done.Closed()) {
+      r.errcode = SNAPSHOT_STOPPED;
+    } else if (!stream.Write(chunk.data(), chunk.size())) {
+      r.errcode = FAILED_TO_SAVE_SNAPSHOT;
+    }
+  }
+  if (r.errcode == SNAPSHOT_OK && !scanner->Status().ok()) {
     std::cerr
-      << "failed to save snapshot: "
-      << std::to_string(ioret.error) << std::endl;
+      << "failed to save snapshot: " << scanner->Status().ToString()
+      << std::endl;
     r.errcode = FAILED_TO_SAVE_SNAPSHOT;
-    return r;
   }
-  r.size += sizeof(uint64_t);
-  // FIXME: use buffer and check IOResult
-  uint64_t len;
-  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-    auto key = iter->key();
-    auto val = iter->value();
-    len = key.size();
-    writer->Write(reinterpret_cast<dragonboat::Byte *>(&len), sizeof(uint64_t));
-    writer->Write(reinterpret_cast<const dragonboat::Byte *>(key.data()), len);
-    len = val.size();
-    writer->Write(reinterpret_cast<dragonboat::Byte *>(&len), sizeof(uint64_t));
-    writer->Write(reinterpret_cast<const dragonboat::Byte *>(val.data()), len);
-    r.size += 2 * sizeof(uint64_t) + key.size() + val.size();
+  if (r.errcode == SNAPSHOT_OK
+    && (!stream.Write(marker, sizeof(uint64_t)) || !stream.Close())) {
+    r.errcode = FAILED_TO_SAVE_SNAPSHOT;
   }
-  r.errcode = SNAPSHOT_OK;
-  delete iter;
-  rocks->db_->ReleaseSnapshot(snapshotptr);
+  r.size = stream.StoredBytes();
+  if (r.errcode == SNAPSHOT_OK) {
+    std::cout << "snapshot saved: " << stream.ToString() << std::endl;
+  }
+  scanner.reset();
+  rocks->db_->ReleaseSnapshot(ctx->snapshot);
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    pinnedTimes_.erase(pinnedTimes_.find(ctx->pinnedTime));
+  }
+  updateGCHorizon();
   return r;
 }
 
+static bool readFull(
+  SnapshotStreamReader *reader,
+  void *data,
+  size_t size) noexcept
+{
+  if (size == 0) {
+    return true;
+  }
+  auto n = reader->Read(reinterpret_cast<char *>(data), size);
+  if (n < 0 || static_cast<size_t>(n) != size) {
+    std::cerr << "failed to recover from snapshot: short read" << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int DiskKV::recoverFromSnapshot(
   dragonboat::SnapshotReader *reader,
   const dragonboat::DoneChan &done) noexcept
 {
   auto dir = getNodeDBDirName(cluster_id_, node_id_);
   auto dbdir = getNewRandomDBDirName(dir);
-  auto oldDirName = getCurrentDBDirName(dir);
   auto rocks = createDB(dbdir);
+  // on every return rocks holds the DB to retire, the new one unless it was
+  // swapped in, which is dropped or trashed once the concurrent
+  // lookup/saveSnapshot release it
+  struct Retire {
+    const DiskKV *kv;
+    std::shared_ptr<RocksDB> &rocks;
+    ~Retire()
+    {
+      if (rocks->shared_) {
+        kv->ttlFilter()->Unregister(rocks->cf_->GetID());
+      }
+      rocks->obsolete_ = true;
+      rocks->trash_ = kv->trash_;
+    }
+  } retire{this, rocks};
+  auto start = nowMicros();
+  SnapshotStreamReader input(
+    [reader](char *data, size_t size) -> int64_t
+    {
+      auto ioret = reader->Read(
+        reinterpret_cast<dragonboat::Byte *>(data), size);
+      if (ioret.error != 0) {
+        std::cerr
+          << "failed to recover from snapshot: "
+          << std::to_string(ioret.error) << std::endl;
+        return -1;
+      }
+      return ioret.size;
+    });
+  // legacy snapshots start with the record count instead of the marker
   uint64_t count = 0;
-  auto ioret = reader->Read(
-    reinterpret_cast<dragonboat::Byte *>(&count), sizeof(uint64_t));
-  if (ioret.error != 0) {
-    std::cerr
-      << "failed to recover from snapshot: "
-      << std::to_string(ioret.error) << std::endl;
+  if (!readFull(&input, &count, sizeof(uint64_t))) {
     return FAILED_TO_RECOVER_FROM_SNAPSHOT;
   }
-  uint64_t len = 0;
-  std::vector<dragonboat::Byte> key, val;
-  for (uint64_t i = 0; i < count; ++i) {
-    reader->Read(reinterpret_cast<dragonboat::Byte *>(&len), sizeof(uint64_t));
-    key.resize(len);
-    reader->Read(key.data(), len);
-    reader->Read(reinterpret_cast<dragonboat::Byte *>(&len), sizeof(uint64_t));
-    val.resize(len);
-    reader->Read(val.data(), len);
-    rocksdb::WriteBatch wb;
-    wb.Put(
-      {reinterpret_cast<const char *>(key.data()), key.size()},
-      {reinterpret_cast<const char *>(val.data()), val.size()});
-    auto s = rocks->db_->Write(rocks->wo_, &wb);
+  bool stream = count == snapshotStreamMarker;
+  // the new DB is not visible until the current file is replaced, the sorted
+  // stream is cut into runs written to SST files in parallel and ingested at
+  // once, the blob profile skips the WAL and flushes once at the end instead
+  // so that large values land in blob files
+  std::unique_ptr<SstBuilder> builder;
+  auto ingestDir = zz::os::path_join({dir, ingestDirName});
+  if (options_.recoverThreads > 0 && !rocks->opts_.enable_blob_files) {
+    zz::os::remove_all(ingestDir);
+    if (!zz::os::create_directory_recursive(ingestDir)) {
+      std::cerr << "failed to create " << ingestDir << std::endl;
+      return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+    }
+    builder.reset(new SstBuilder(
+      rocks->opts_, rocks->cf_, ingestDir, options_.recoverThreads));
+  }
+  auto wo = rocks->wo_;
+  wo.sync = false;
+  wo.disableWAL = true;
+  rocksdb::WriteBatch wb;
+  auto write = [&rocks, &wo, &wb]() -> bool
+  {
+    auto s = rocks->db_->Write(wo, &wb);
     if (!s.ok()) {
       std::cerr
         << "failed to recover from snapshot: " << s.ToString() << std::endl;
+      return false;
+    }
+    wb.Clear();
+    return true;
+  };
+  std::string run;
+  auto appendLen = [&run](uint64_t len)
+  {
+    run.append(reinterpret_cast<const char *>(&len), sizeof(uint64_t));
+  };
+  uint64_t len = 0;
+  std::string key, val;
+  for (uint64_t i = 0; stream || i < count; ++i) {
+    if (!readFull(&input, &len, sizeof(uint64_t))) {
+      return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+    }
+    if (stream && len == snapshotStreamMarker) {
+      break;
+    }
+    key.resize(len);
+    if (!readFull(&input, &key[0], len)
+      || !readFull(&input, &len, sizeof(uint64_t))) {
+      return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+    }
+    val.resize(len);
+    if (!readFull(&input, &val[0], len)) {
+      return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+    }
+    if (builder) {
+      appendLen(key.size());
+      run.append(key);
+      appendLen(val.size());
+      run.append(val);
+      if (run.size() >= sstRunBytes) {
+        if (done.Closed()) {
+          return SNAPSHOT_STOPPED;
+        }
+        // a failed run is reported by Finish
+        if (!builder->Add(std::move(run))) {
+          break;
+        }
+        run.clear();
+      }
+      continue;
+    }
+    wb.Put(rocks->cf_, key, val);
+    if (wb.GetDataSize() >= snapshotBufferSize) {
+      if (done.Closed()) {
+        return SNAPSHOT_STOPPED;
+      }
+      if (!write()) {
+        return FAILED_TO_RECOVER_FROM_SNAPSHOT;
+      }
+    }
+  }
+  rocksdb::Status s;
+  if (builder) {
+    if (!run.empty()) {
+      builder->Add(std::move(run));
+    }
+    std::vector<std::string> files;
+    s = builder->Finish(&files);
+    if (s.ok() && !files.empty()) {
+      rocksdb::IngestExternalFileOptions ifo;
+      ifo.move_files = true;
+      s = rocks->db_->IngestExternalFile(rocks->cf_, files, ifo);
+    }
+    builder.reset();
+    zz::os::remove_all(ingestDir);
+  } else {
+    if (wb.Count() > 0 && !write()) {
       return FAILED_TO_RECOVER_FROM_SNAPSHOT;
     }
+    s = rocks->db_->Flush(rocksdb::FlushOptions(), rocks->cf_);
+  }
+  if (!s.ok()) {
+    std::cerr
+      << "failed to recover from snapshot: " << s.ToString() << std::endl;
+    return FAILED_TO_RECOVER_FROM_SNAPSHOT;
   }
-  saveCurrentDBDirName(dir, dbdir);
-  replaceCurrentDBFile(dir);
   auto newLastApplied = queryAppliedIndex(rocks.get());
   if (lastApplied_ > newLastApplied) {
     std::cerr
@@ -241,12 +695,27 @@ int DiskKV::recoverFromSnapshot(
       << ", newLastApplied " << newLastApplied << std::endl;
     return FAILED_TO_RECOVER_FROM_SNAPSHOT;
   }
+  DBManifest manifest;
+  manifest.dbdir = dbdir;
+  manifest.appliedIndex = newLastApplied;
+  saveManifest(dir, manifest);
   lastApplied_ = newLastApplied;
+  std::cout
+    << "snapshot recovered: codec=" << SnapshotCodecName(input.Codec())
+    << " ms=" << (nowMicros() - start) / 1000 << std::endl;
   {
     std::lock_guard<std::mutex> guard(mtx_);
     rocks_.swap(rocks);
   }
-  zz::os::remove_all(oldDirName);
+  if (rowCache_) {
+    rowCache_->Clear();
+  }
+  loadTTLState(rocks_.get());
+  startFilterBuild(rocks_);
+  // the watchers cannot tell which keys the snapshot changed
+  if (options_.watch && options_.watch->Active()) {
+    options_.watch->Publish({newLastApplied, WATCH_RESYNC, "", ""});
+  }
   return SNAPSHOT_OK;
 }
 
@@ -255,43 +724,173 @@ void DiskKV::freeLookupResult(LookupResult r) noexcept
   delete[] r.result;
 }
 
+rocksdb::Options DiskKV::createOptions() const
+{
+  auto opts = rocksdb::Options();
+  opts.create_if_missing = true;
+  opts.use_fsync = true;
+  opts.merge_operator = std::make_shared<DiskKVMergeOperator>();
+  rocksdb::BlockBasedTableOptions table;
+  options_.profile.Apply(&opts, &table);
+  if (options_.shared) {
+    options_.shared->Configure(&opts, &table);
+  }
+  opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+  opts.compaction_filter_factory = ttlFilter();
+  return opts;
+}
+
 std::shared_ptr<RocksDB> DiskKV::createDB(std::string dbdir)
 {
   auto rocks = std::make_shared<RocksDB>();
-  rocks->opts_ = rocksdb::Options();
-  rocks->opts_.create_if_missing = true;
-  rocks->opts_.use_fsync = true;
+  rocks->name_ = dbdir;
+  rocks->opts_ = createOptions();
   rocks->ro_ = rocksdb::ReadOptions();
   rocks->wo_ = rocksdb::WriteOptions();
   rocks->wo_.sync = true;
+  if (options_.shared && options_.shared->SingleDB()) {
+    rocks->shared_ = options_.shared;
+    rocks->cf_ = rocks->shared_->GetColumnFamily(dbdir, rocks->opts_);
+    rocks->db_ = rocks->shared_->DB();
+    ttlFilter()->Register(rocks->cf_->GetID(), gcHorizon_);
+    return rocks;
+  }
   rocksdb::DB *db = nullptr;
   auto s = rocksdb::DB::Open(rocks->opts_, dbdir, &db);
   if (!s.ok()) {
     throw std::runtime_error("failed to create RocksDB: " + s.ToString());
   }
   rocks->db_.reset(db);
+  rocks->cf_ = db->DefaultColumnFamily();
+  ttlFilter()->Register(rocks->cf_->GetID(), gcHorizon_);
   return rocks;
 }
 
+bool DiskKV::dbExists(const std::string &dbdir) const
+{
+  if (options_.shared && options_.shared->SingleDB()) {
+    return options_.shared->HasColumnFamily(dbdir);
+  }
+  return zz::os::is_directory(dbdir);
+}
+
+std::string DiskKV::getStats(RocksDB *db) const
+{
+  static const std::string properties[] = {
+    "rocksdb.estimate-num-keys",
+    "rocksdb.live-sst-files-size",
+    "rocksdb.num-blob-files",
+    "rocksdb.live-blob-file-size",
+    "rocksdb.total-blob-file-size",
+    "rocksdb.estimate-live-data-size",
+    "rocksdb.cur-size-all-mem-tables",
+    "rocksdb.block-cache-usage",
+    "rocksdb.estimate-table-readers-mem",
+    "rocksdb.estimate-pending-compaction-bytes",
+  };
+  auto filter = std::atomic_load(&db->filter_);
+  std::stringstream ss;
+  ss << stats_.ToString() << "\n"
+     << "open_ms: " << openMicros_ / 1000 << "\n"
+     << "trash: " << trash_->ToString() << "\n"
+     << "bloom_bytes: " << (filter ? filter->MemoryBytes() : 0) << "\n"
+     << "bloom_negatives: " << bloomNegatives_.load() << "\n"
+     << "bloom_false_positives: " << bloomFalsePositives_.load() << "\n"
+     << "row_cache: " << (rowCache_ ? rowCache_->ToString() : "disabled")
+     << "\n"
+     << "cache_hit_ns: " << cacheHitNanos_.ToString() << "\n"
+     << "db_lookup_ns: " << dbLookupNanos_.ToString() << "\n"
+     << "applied_time: " << appliedTime_.load() << "\n"
+     << "ttl_gc_horizon: " << gcHorizon_->load();
+  for (auto &property : properties) {
+    uint64_t value = 0;
+    if (db->db_->GetIntProperty(db->cf_, property, &value)) {
+      ss << "\n" << property << ": " << value;
+    }
+  }
+  return ss.str();
+}
+
+std::vector<std::string> DiskKV::snapshotBoundaries(RocksDB *db) const
+{
+  // about 4 ranges per thread of similar SST size, the boundaries only
+  // balance the scan, any split produces the same snapshot
+  std::vector<std::string> boundaries;
+  uint64_t parts = options_.snapshotThreads * 4;
+  if (parts <= 1) {
+    return boundaries;
+  }
+  std::vector<rocksdb::LiveFileMetaData> files;
+  db->db_->GetLiveFilesMetaData(&files);
+  std::vector<std::pair<std::string, uint64_t>> starts;
+  uint64_t total = 0;
+  for (auto &file : files) {
+    if (file.column_family_name == db->cf_->GetName()) {
+      starts.emplace_back(file.smallestkey, file.size);
+      total += file.size;
+    }
+  }
+  std::sort(starts.begin(), starts.end());
+  uint64_t step = total / parts;
+  uint64_t scanned = 0;
+  for (auto &start : starts) {
+    if (step != 0 && scanned >= step * (boundaries.size() + 1)
+      && (boundaries.empty() || start.first > boundaries.back())) {
+      boundaries.push_back(start.first);
+    }
+    scanned += start.second;
+  }
+  return boundaries;
+}
+
 uint64_t DiskKV::queryAppliedIndex(RocksDB *db) const
+{
+  return queryUint64(db, appliedIndexKey);
+}
+
+uint64_t DiskKV::queryUint64(RocksDB *db, const std::string &key) const
 {
   std::string data;
-  rocksdb::Slice slice(appliedIndexKey.data(), appliedIndexKey.length());
-  auto s = db->db_->Get(db->ro_, slice, &data);
+  rocksdb::Slice slice(key.data(), key.length());
+  auto s = db->db_->Get(db->ro_, db->cf_, slice, &data);
   if (!s.ok()) {
-    std::cerr << "failed to query applied index: " << s.ToString() << std::endl;
+    if (!s.IsNotFound()) {
+      std::cerr
+        << "failed to query " << key << ": " << s.ToString() << std::endl;
+    }
     return 0;
   }
-  if (data.empty()) {
-    return 0;
+  return std::strtoull(data.c_str(), nullptr, 10);
+}
+
+void DiskKV::loadTTLState(RocksDB *db)
+{
+  appliedTime_ = queryUint64(db, appliedTimeKey);
+  ttlInUse_ = queryUint64(db, ttlInUseKey) != 0;
+  updateGCHorizon();
+}
+
+std::shared_ptr<TTLFilterFactory> DiskKV::ttlFilter() const
+{
+  if (options_.shared && options_.shared->SingleDB()) {
+    return options_.shared->TTLFilter();
+  }
+  return ownTTLFilter_;
+}
+
+void DiskKV::updateGCHorizon() const
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  uint64_t horizon = appliedTime_;
+  if (!pinnedTimes_.empty()) {
+    horizon = std::min(horizon, *pinnedTimes_.begin());
   }
-  return std::stoull(data);
+  gcHorizon_->store(horizon);
 }
 
 bool DiskKV::isNewRun(std::string dir) noexcept
 {
-  auto fp = zz::os::path_join({dir, currentDBFilename});
-  return !zz::os::is_file(fp);
+  return !hasManifest(dir);
 }
 
 std::string DiskKV::getNodeDBDirName(
@@ -314,71 +913,102 @@ std::string DiskKV::getNewRandomDBDirName(std::string dir) noexcept
   return zz::os::path_join({dir, ss.str()});
 }
 
-void DiskKV::replaceCurrentDBFile(std::string dir)
+void DiskKV::createNodeDataDir(std::string dir)
 {
-  auto fp = zz::os::path_join({dir, currentDBFilename});
-  auto tmpFp = zz::os::path_join({dir, updatingDBFilename});
-  if (!zz::os::rename(tmpFp, fp)) {
-    throw std::runtime_error("failed to rename " + tmpFp + " to " + fp);
+  if (!zz::os::create_directory_recursive(dir)) {
+    throw std::runtime_error("failed to create node data dir");
   }
 }
 
-void DiskKV::saveCurrentDBDirName(std::string dir, std::string dbdir)
+void DiskKV::cleanupNodeDataDir(std::string dir, std::string dbdir)
 {
-  // FIXME: MD5 verification
-  auto fp = zz::os::path_join({dir, updatingDBFilename});
-  std::fstream f(fp, std::ios::out);
-  if (f.bad()) {
-    throw std::runtime_error("failed to save current dbdir name");
+  if (options_.shared && options_.shared->SingleDB()) {
+    auto prefix = zz::os::path_join({dir, ""});
+    for (auto &name : options_.shared->ListColumnFamilies(prefix)) {
+      if (name != dbdir) {
+        std::cout << "dropping column family " << name << std::endl;
+        options_.shared->DropColumnFamily(name);
+      }
+    }
   }
-  f << dbdir;
-  f.sync();
-  if (f.bad()) {
-    throw std::runtime_error("failed to save current dbdir name");
+  zz::fs::Directory entries(dir);
+  for (auto &item : entries) {
+    if (!item.is_dir()) {
+      continue;
+    }
+    auto fname = zz::os::path_split_filename(item.abs_path());
+    auto path = zz::os::path_join({dir, fname});
+    if (path != dbdir && !trash_->Add(path)) {
+      zz::os::remove_all(path);
+    }
   }
 }
 
-std::string DiskKV::getCurrentDBDirName(std::string dir)
+void DiskKV::startFilterBuild(std::shared_ptr<RocksDB> rocks)
 {
-  auto fp = zz::os::path_join({dir, currentDBFilename});
-  std::fstream f(fp, std::ios::in);
-  if (f.bad()) {
-    throw std::runtime_error("failed to get current dbdir name");
+  if (options_.bloomBitsPerKey == 0) {
+    return;
   }
-  std::string data;
-  f >> data;
-  if (f.bad()) {
-    throw std::runtime_error("failed to get current dbdir name");
+  stopFilterBuild();
+  uint64_t keys = 0;
+  rocks->db_->GetIntProperty(rocks->cf_, "rocksdb.estimate-num-keys", &keys);
+  auto filter = std::make_shared<BlockedBloomFilter>(
+    std::max(keys * 2, minBloomKeys), options_.bloomBitsPerKey);
+  const rocksdb::Snapshot *snapshot = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(filterMtx_);
+    building_ = filter;
+    snapshot = rocks->db_->GetSnapshot();
   }
-  return data;
+  filterBuilder_ = std::thread(
+    &DiskKV::buildFilter, this, std::move(rocks), std::move(filter),
+    snapshot);
 }
 
-void DiskKV::createNodeDataDir(std::string dir)
+void DiskKV::stopFilterBuild()
 {
-  if (!zz::os::create_directory_recursive(dir)) {
-    throw std::runtime_error("failed to create node data dir");
+  if (filterBuilder_.joinable()) {
+    stopFilterBuild_ = true;
+    filterBuilder_.join();
+    stopFilterBuild_ = false;
   }
 }
 
-void DiskKV::cleanupNodeDataDir(std::string dir)
+void DiskKV::buildFilter(
+  std::shared_ptr<RocksDB> rocks,
+  std::shared_ptr<BlockedBloomFilter> filter,
+  const rocksdb::Snapshot *snapshot) noexcept
 {
-  zz::os::remove_all(zz::os::path_join({dir, updatingDBFilename}));
-  auto dbdir = getCurrentDBDirName(dir);
-  zz::fs::Directory dir_(dir);
-  for (auto &item : dir_) {
-    if (!item.is_dir()) {
-      continue;
-    }
-    auto fname = zz::os::path_split_filename(item.abs_path());
-    std::cout
-      << "dbdir " << dbdir << ", fi.name " << fname
-      << ", dir " << dir << std::endl;
-    auto toDelete = zz::os::path_join({dir, fname});
-    if (toDelete != dbdir) {
-      std::cout << "removing " << toDelete << std::endl;
-      if (!zz::os::remove_all(toDelete)) {
-        throw std::runtime_error("failed to remove " + toDelete);
-      }
+  auto start = nowMicros();
+  auto ro = rocks->ro_;
+  ro.snapshot = snapshot;
+  ro.fill_cache = false;
+  ro.readahead_size = options_.snapshotReadaheadBytes;
+  std::unique_ptr<rocksdb::Iterator> it(
+    rocks->db_->NewIterator(ro, rocks->cf_));
+  uint64_t keys = 0;
+  for (it->SeekToFirst(); it->Valid() && !stopFilterBuild_; it->Next()) {
+    filter->Add(it->key().data(), it->key().size());
+    keys++;
+  }
+  auto s = it->status();
+  it.reset();
+  rocks->db_->ReleaseSnapshot(snapshot);
+  {
+    std::lock_guard<std::mutex> guard(filterMtx_);
+    if (building_ == filter) {
+      building_.reset();
     }
   }
-}
\ No newline at end of file
+  if (!s.ok()) {
+    std::cerr << "failed to build bloom filter: " << s.ToString() << std::endl;
+    return;
+  } else if (stopFilterBuild_) {
+    return;
+  }
+  std::atomic_store(&rocks->filter_, filter);
+  std::cout
+    << "bloom filter built: keys=" << keys
+    << " bytes=" << filter->MemoryBytes()
+    << " ms=" << (nowMicros() - start) / 1000 << std::endl;
+}
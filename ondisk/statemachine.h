@@ -15,20 +15,107 @@
 #ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_STATEMACHINE_H_
 #define DRAGONBOAT_CPP_EXAMPLE_ONDISK_STATEMACHINE_H_
 
+#include <set>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <rocksdb/db.h>
 #include <dragonboat/statemachine/ondisk.h>
+#include "histogram.h"
+#include "snapshotstream.h"
+#include "tokenbucket.h"
+#include "profile.h"
+#include "shareddb.h"
+#include "ttlfilter.h"
+#include "trashreclaimer.h"
+#include "bloomfilter.h"
+#include "rowcache.h"
+#include "watchhub.h"
+#include "utils.h"
 
 const std::string appliedIndexKey = "disk_kv_applied_index";
+// the Raft-applied time, the largest tick applied, in unix milliseconds
+const std::string appliedTimeKey = "disk_kv_applied_time";
+const std::string ttlInUseKey = "disk_kv_ttl_in_use";
 const std::string testDBDirName = "example-data";
-const std::string currentDBFilename = "current";
-const std::string updatingDBFilename = "current.updating";
+const std::string ingestDirName = "ingest";
+// the lookup filter is rebuilt once saturated, sized for twice the estimated
+// keys and at least minBloomKeys
+constexpr uint64_t minBloomKeys = 64 * 1024;
+const std::string statsQuery = taggedQuery("stats");
+// answered with 1 once the group has applied a put with TTL, 0 otherwise
+const std::string ttlInUseQuery = taggedQuery("ttl_in_use");
+// snapshot format: the marker followed by (keylen, key, vallen, val) records
+// in key order and terminated by the marker in place of a keylen, snapshots
+// starting with the record count instead of the marker are still recovered
+constexpr uint64_t snapshotStreamMarker = UINT64_MAX;
+constexpr size_t snapshotBufferSize = 4 * 1024 * 1024;
+// bytes of records per SST file built when recovering from a snapshot
+constexpr size_t sstRunBytes = 32 * 1024 * 1024;
+
+struct DiskKVOptions {
+  // group commit, when coalesceBytes is not 0, batchedUpdate writes to RocksDB
+  // without fsync and the WAL is synced once the unsynced batches exceed
+  // coalesceBytes or the oldest unsynced batch is older than coalesceMicros,
+  // the unsynced tail is replayed from the Raft log after a crash as the
+  // applied index is written in the same WriteBatch
+  uint64_t coalesceBytes = 0;
+  uint64_t coalesceMicros = 1000;
+  // threads scanning key ranges in parallel when saving a snapshot
+  size_t snapshotThreads = 4;
+  // threads building SST files when recovering from a snapshot, 0 to write
+  // the snapshot through WriteBatches
+  size_t recoverThreads = 4;
+  SnapshotCodec snapshotCodec = CODEC_NONE;
+  // snapshot scans bypass the block cache and read ahead readahead bytes,
+  // limiter (shared by all DiskKV instances, nullptr for no limit) throttles
+  // them so that they do not starve lookup of disk bandwidth
+  size_t snapshotReadaheadBytes = 2 * 1024 * 1024;
+  std::shared_ptr<TokenBucket> snapshotLimiter;
+  // deletes the DB dirs replaced by recoverFromSnapshot or left by an earlier
+  // run, shared by all DiskKV instances of the node, nullptr to use one per
+  // DiskKV deleting at full speed
+  std::shared_ptr<TrashReclaimer> trash;
+  // bits per key of the filter answering lookup misses without a RocksDB Get,
+  // 0 to disable it, the filter is built by scanning the DB in the background
+  // after open and recoverFromSnapshot and lookups bypass it until then
+  size_t bloomBitsPerKey = 0;
+  // capacity of the cache of values read by lookup, 0 to disable it
+  size_t rowCacheBytes = 0;
+  // receives the changes applied by batchedUpdate, nullptr for none
+  std::shared_ptr<WatchHub> watch;
+  RocksDBProfile profile;
+  // resources shared with other DiskKV instances, nullptr to use a private
+  // RocksDB with default resources
+  std::shared_ptr<SharedRocksDB> shared;
+};
+
+// telemetry of batchedUpdate, each histogram records one sample per call
+struct BatchStats {
+  Histogram entries;
+  Histogram bytes;
+  Histogram buildMicros;
+  Histogram writeMicros;
+  std::atomic<uint64_t> syncs{0};
+  std::string ToString() const;
+};
 
 struct RocksDB {
-  std::unique_ptr<rocksdb::DB> db_;
+  std::shared_ptr<rocksdb::DB> db_;
+  // the default column family of a private RocksDB or the column family owned
+  // by this DiskKV in the shared RocksDB
+  rocksdb::ColumnFamilyHandle *cf_ = nullptr;
+  std::string name_;
+  std::shared_ptr<SharedRocksDB> shared_;
+  // drop the column family in the shared RocksDB, or move the private RocksDB
+  // to trash_, once released
+  bool obsolete_ = false;
+  std::shared_ptr<TrashReclaimer> trash_;
   rocksdb::Options opts_;
   rocksdb::ReadOptions ro_;
   rocksdb::WriteOptions wo_;
+  // nullptr until built, accessed with std::atomic_load and std::atomic_store
+  std::shared_ptr<BlockedBloomFilter> filter_;
   ~RocksDB();
 };
 
@@ -36,7 +123,10 @@ struct RocksDB {
 // update/prepareSnapshot can not be concurrently invoked
 class DiskKV : public dragonboat::OnDiskStateMachine {
  public:
-  DiskKV(uint64_t clusterID, uint64_t nodeID) noexcept;
+  DiskKV(
+    uint64_t clusterID,
+    uint64_t nodeID,
+    const DiskKVOptions &options = DiskKVOptions()) noexcept;
   ~DiskKV() override;
  protected:
   OpenResult open(const dragonboat::DoneChan &done) noexcept override;
@@ -56,23 +146,74 @@ class DiskKV : public dragonboat::OnDiskStateMachine {
     const dragonboat::DoneChan &done) noexcept override;
   void freeLookupResult(LookupResult r) noexcept override;
  private:
+  rocksdb::Options createOptions() const;
   std::shared_ptr<RocksDB> createDB(std::string dbdir);
+  bool dbExists(const std::string &dbdir) const;
+  std::string getStats(RocksDB *db) const;
+  // splits the key space of db for the parallel snapshot scan
+  std::vector<std::string> snapshotBoundaries(RocksDB *db) const;
   uint64_t queryAppliedIndex(RocksDB *db) const;
+  uint64_t queryUint64(RocksDB *db, const std::string &key) const;
+  // loads the Raft-applied time and the TTL flag persisted in db
+  void loadTTLState(RocksDB *db);
+  std::shared_ptr<TTLFilterFactory> ttlFilter() const;
+  // publishes min(appliedTime_, oldest pinned snapshot time) to the filter
+  void updateGCHorizon() const;
   static bool isNewRun(std::string dir) noexcept;
   static std::string getNodeDBDirName(
     uint64_t clusterID,
     uint64_t nodeID) noexcept;
   static std::string getNewRandomDBDirName(std::string dir) noexcept;
-  static void replaceCurrentDBFile(std::string dir);
-  static void saveCurrentDBDirName(std::string dir, std::string dbdir);
-  static std::string getCurrentDBDirName(std::string dir);
   static void createNodeDataDir(std::string dir);
-  static void cleanupNodeDataDir(std::string dir);
+  // drops the column families and trashes the db dirs of dir other than dbdir
+  void cleanupNodeDataDir(std::string dir, std::string dbdir);
+  // scans rocks on a background thread into a new filter installed once
+  // complete, the filter being built also receives the keys of batchedUpdate
+  void startFilterBuild(std::shared_ptr<RocksDB> rocks);
+  void stopFilterBuild();
+  void buildFilter(
+    std::shared_ptr<RocksDB> rocks,
+    std::shared_ptr<BlockedBloomFilter> filter,
+    const rocksdb::Snapshot *snapshot) noexcept;
  private:
   DISALLOW_COPY_MOVE_AND_ASSIGN(DiskKV);
+  const DiskKVOptions options_;
   mutable std::mutex mtx_;
   std::shared_ptr<RocksDB> rocks_;
-  uint64_t lastApplied_;
+  // read by lookup to answer appliedQuery
+  std::atomic<uint64_t> lastApplied_;
+  BatchStats stats_;
+  // bytes written since the last WAL sync and the time (in microseconds since
+  // the steady clock epoch) of the oldest of them, 0 if all synced
+  mutable std::atomic<uint64_t> unsyncedBytes_;
+  mutable std::atomic<uint64_t> unsyncedSince_;
+  std::atomic<uint64_t> appliedTime_;
+  std::atomic<bool> ttlInUse_;
+  // used when the DiskKV owns a private RocksDB
+  std::shared_ptr<TTLFilterFactory> ownTTLFilter_;
+  std::shared_ptr<std::atomic<uint64_t>> gcHorizon_;
+  // applied times of the snapshots being saved, protected by mtx_, values
+  // expired after the oldest one are kept so that the snapshot iterator still
+  // sees them
+  mutable std::multiset<uint64_t> pinnedTimes_;
+  uint64_t openMicros_;
+  std::shared_ptr<TrashReclaimer> trash_;
+  // batchedUpdate adds the keys of a batch to the filters and writes the
+  // batch under filterMtx_, startFilterBuild sets building_ and takes the
+  // snapshot to scan under it, so every key is either scanned or added
+  std::mutex filterMtx_;
+  std::shared_ptr<BlockedBloomFilter> building_;
+  std::thread filterBuilder_;
+  std::atomic<bool> stopFilterBuild_;
+  mutable std::atomic<uint64_t> bloomNegatives_;
+  mutable std::atomic<uint64_t> bloomFalsePositives_;
+  // nullptr if disabled, see RowCache for how it is kept consistent with the
+  // applied state
+  std::unique_ptr<RowCache> rowCache_;
+  // lookup latency in nanoseconds of the row cache hits and of the key
+  // lookups reading RocksDB
+  mutable Histogram cacheHitNanos_;
+  mutable Histogram dbLookupNanos_;
 };
 
 #endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_STATEMACHINE_H_
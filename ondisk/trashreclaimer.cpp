@@ -0,0 +1,174 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "trashreclaimer.h"
+#include "zupply.hpp"
+
+TrashReclaimer::TrashReclaimer(std::string trashDir, uint64_t bytesPerSec)
+  : trashDir_(std::move(trashDir)), stopped_(false), added_(0),
+    deletedFiles_(0), deletedBytes_(0)
+{
+  if (!zz::os::is_directory(trashDir_)
+    && !zz::os::create_directory_recursive(trashDir_)) {
+    throw std::runtime_error("failed to create " + trashDir_);
+  }
+  if (bytesPerSec != 0) {
+    limiter_.reset(new TokenBucket(bytesPerSec));
+  }
+  // left by the previous run
+  DIR *d = ::opendir(trashDir_.c_str());
+  if (d == nullptr) {
+    throw std::runtime_error("failed to open " + trashDir_);
+  }
+  while (auto *e = ::readdir(d)) {
+    if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+      pending_.push_back(zz::os::path_join({trashDir_, e->d_name}));
+    }
+  }
+  ::closedir(d);
+  std::sort(pending_.begin(), pending_.end());
+  worker_ = std::thread(&TrashReclaimer::work, this);
+}
+
+TrashReclaimer::~TrashReclaimer()
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  worker_.join();
+}
+
+bool TrashReclaimer::Add(const std::string &path) noexcept
+{
+  std::stringstream ss;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    // unique across restarts as the trash dir may not be empty
+    ss << std::chrono::system_clock::now().time_since_epoch().count()
+       << "_" << added_++ << "_" << zz::os::path_split_filename(path);
+  }
+  auto dst = zz::os::path_join({trashDir_, ss.str()});
+  if (::rename(path.c_str(), dst.c_str()) != 0) {
+    std::cerr
+      << "failed to move " << path << " to " << dst << ": "
+      << strerror(errno) << std::endl;
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    pending_.push_back(dst);
+  }
+  cv_.notify_one();
+  return true;
+}
+
+std::string TrashReclaimer::ToString() const
+{
+  std::stringstream ss;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    ss << "pending: " << pending_.size();
+  }
+  ss << ", deleted_files: " << deletedFiles_.load()
+     << ", deleted_bytes: " << deletedBytes_.load();
+  return ss.str();
+}
+
+void TrashReclaimer::work()
+{
+  for (;;) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [this]() { return stopped_ || !pending_.empty(); });
+      if (stopped_) {
+        return;
+      }
+      path = pending_.front();
+    }
+    if (!reclaim(path)) {
+      return;
+    }
+    std::lock_guard<std::mutex> guard(mtx_);
+    pending_.pop_front();
+  }
+}
+
+bool TrashReclaimer::reclaim(const std::string &path)
+{
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0) {
+    return true;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    std::vector<std::string> children;
+    DIR *d = ::opendir(path.c_str());
+    if (d != nullptr) {
+      while (auto *e = ::readdir(d)) {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+          children.push_back(zz::os::path_join({path, e->d_name}));
+        }
+      }
+      ::closedir(d);
+    }
+    for (auto &child : children) {
+      if (!reclaim(child)) {
+        return false;
+      }
+    }
+    if (::rmdir(path.c_str()) != 0 && errno != ENOENT) {
+      std::cerr
+        << "failed to remove " << path << ": " << strerror(errno) << std::endl;
+    }
+    return true;
+  }
+  if (limiter_) {
+    // in slices of 100ms so that stopping does not wait for a large file
+    uint64_t slice = std::max<uint64_t>(limiter_->BytesPerSec() / 10, 1);
+    for (uint64_t left = st.st_size; left > 0;) {
+      if (stopped_) {
+        return false;
+      }
+      auto n = std::min(left, slice);
+      limiter_->Request(n);
+      left -= n;
+    }
+  }
+  if (stopped_) {
+    return false;
+  }
+  if (::unlink(path.c_str()) != 0) {
+    if (errno != ENOENT) {
+      std::cerr
+        << "failed to remove " << path << ": " << strerror(errno) << std::endl;
+    }
+    return true;
+  }
+  deletedFiles_++;
+  deletedBytes_ += st.st_size;
+  return true;
+}
@@ -0,0 +1,59 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_TRASHRECLAIMER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_TRASHRECLAIMER_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "tokenbucket.h"
+
+// TrashReclaimer deletes obsolete DB dirs on a background thread, a dir is
+// renamed into the trash dir (which must be on the same file system) so that
+// the caller does not wait for thousands of SST files to be unlinked, and
+// unlinks are paced by the file sizes, whatever is left in the trash dir is
+// deleted after a restart
+class TrashReclaimer {
+ public:
+  // bytesPerSec of 0 deletes at full speed
+  TrashReclaimer(std::string trashDir, uint64_t bytesPerSec);
+  // stops deleting, the remaining entries are deleted after a restart
+  ~TrashReclaimer();
+  // moves path into the trash dir, returns false if it can not be renamed
+  bool Add(const std::string &path) noexcept;
+  std::string ToString() const;
+ private:
+  void work();
+  // deletes path depth first, returns false if stopped
+  bool reclaim(const std::string &path);
+  const std::string trashDir_;
+  std::unique_ptr<TokenBucket> limiter_;
+  mutable std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<std::string> pending_;
+  std::atomic<bool> stopped_;
+  uint64_t added_;
+  std::atomic<uint64_t> deletedFiles_;
+  std::atomic<uint64_t> deletedBytes_;
+  std::thread worker_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_TRASHRECLAIMER_H_
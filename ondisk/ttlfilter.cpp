@@ -0,0 +1,78 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ttlfilter.h"
+#include "value.h"
+
+namespace {
+
+class TTLFilter : public rocksdb::CompactionFilter {
+ public:
+  explicit TTLFilter(uint64_t horizon) noexcept : horizon_(horizon)
+  {}
+  bool Filter(
+    int level,
+    const rocksdb::Slice &key,
+    const rocksdb::Slice &existing_value,
+    std::string *new_value,
+    bool *value_changed) const override
+  {
+    rocksdb::Slice value;
+    uint64_t expiry = 0;
+    if (!decodeValue(existing_value, &value, &expiry)) {
+      return false;
+    }
+    return isExpired(expiry, horizon_);
+  }
+  const char *Name() const override
+  {
+    return "TTLFilter";
+  }
+ private:
+  const uint64_t horizon_;
+};
+
+} // namespace
+
+void TTLFilterFactory::Register(
+  uint32_t cfID,
+  std::shared_ptr<std::atomic<uint64_t>> horizon)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  horizons_[cfID] = std::move(horizon);
+}
+
+void TTLFilterFactory::Unregister(uint32_t cfID)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  horizons_.erase(cfID);
+}
+
+std::unique_ptr<rocksdb::CompactionFilter>
+TTLFilterFactory::CreateCompactionFilter(
+  const rocksdb::CompactionFilter::Context &context)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  auto it = horizons_.find(context.column_family_id);
+  if (it == horizons_.end()) {
+    return nullptr;
+  }
+  return std::unique_ptr<rocksdb::CompactionFilter>(
+    new TTLFilter(it->second->load()));
+}
+
+const char *TTLFilterFactory::Name() const
+{
+  return "TTLFilterFactory";
+}
@@ -0,0 +1,44 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_TTLFILTER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_TTLFILTER_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <rocksdb/compaction_filter.h>
+
+// TTLFilterFactory creates compaction filters physically removing the values
+// expired at the GC horizon of their column family, the horizon is published
+// by the owning DiskKV and never exceeds its Raft-applied time so only values
+// already hidden from lookup are removed, column families without a horizon
+// are left untouched
+class TTLFilterFactory : public rocksdb::CompactionFilterFactory {
+ public:
+  void Register(
+    uint32_t cfID,
+    std::shared_ptr<std::atomic<uint64_t>> horizon);
+  void Unregister(uint32_t cfID);
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+    const rocksdb::CompactionFilter::Context &context) override;
+  const char *Name() const override;
+ private:
+  std::mutex mtx_;
+  std::unordered_map<uint32_t, std::shared_ptr<std::atomic<uint64_t>>>
+    horizons_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_TTLFILTER_H_
@@ -0,0 +1,59 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "value.h"
+
+std::string encodeValue(const rocksdb::Slice &value, uint64_t expiry)
+{
+  if (expiry == 0 && (value.empty() || value[0] != valueHeader)) {
+    return value.ToString();
+  }
+  std::string stored;
+  stored.reserve(value.size() + 10);
+  stored.push_back(valueHeader);
+  if (expiry == 0) {
+    stored.push_back(plainValueTag);
+  } else {
+    stored.push_back(ttlValueTag);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      stored.push_back(static_cast<char>((expiry >> shift) & 0xff));
+    }
+  }
+  stored.append(value.data(), value.size());
+  return stored;
+}
+
+bool decodeValue(
+  const rocksdb::Slice &stored,
+  rocksdb::Slice *value,
+  uint64_t *expiry)
+{
+  *expiry = 0;
+  if (stored.empty() || stored[0] != valueHeader) {
+    *value = stored;
+    return true;
+  }
+  if (stored.size() >= 2 && stored[1] == plainValueTag) {
+    *value = rocksdb::Slice(stored.data() + 2, stored.size() - 2);
+    return true;
+  }
+  if (stored.size() >= 10 && stored[1] == ttlValueTag) {
+    for (size_t i = 2; i < 10; ++i) {
+      *expiry = (*expiry << 8) | static_cast<unsigned char>(stored[i]);
+    }
+    *value = rocksdb::Slice(stored.data() + 10, stored.size() - 10);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,45 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_ONDISK_VALUE_H_
+#define DRAGONBOAT_CPP_EXAMPLE_ONDISK_VALUE_H_
+
+#include <string>
+#include <cstdint>
+#include <rocksdb/slice.h>
+
+// values without expiry are stored as is unless they start with '\0', values
+// with an expiry (or starting with '\0') are stored with a header:
+// '\0' 'p' value                    - plain value starting with '\0'
+// '\0' 't' expiry(8 bytes BE) value - expires at the Raft-applied time expiry
+const char valueHeader = '\0';
+const char plainValueTag = 'p';
+const char ttlValueTag = 't';
+
+// returns the stored form of value, expiry is in milliseconds of the
+// Raft-applied time and 0 means never expires
+std::string encodeValue(const rocksdb::Slice &value, uint64_t expiry);
+
+// decodes a stored value, returns false if the header is corrupted
+bool decodeValue(
+  const rocksdb::Slice &stored,
+  rocksdb::Slice *value,
+  uint64_t *expiry);
+
+inline bool isExpired(uint64_t expiry, uint64_t now) noexcept
+{
+  return expiry != 0 && expiry <= now;
+}
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_ONDISK_VALUE_H_
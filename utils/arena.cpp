@@ -0,0 +1,93 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <utility>
+#include "arena.h"
+
+Arena::Arena(size_t blockBytes) noexcept
+  : blockBytes_(blockBytes), pos_(nullptr), left_(0), allocated_(0),
+    live_(0), garbage_(0)
+{
+}
+
+StringRef Arena::Add(const char *data, size_t size)
+{
+  if (size == 0) {
+    return StringRef();
+  }
+  char *dst;
+  if (size > blockBytes_ / 4) {
+    // large strings get a block of their own so that the tail of the current
+    // block is not wasted
+    blocks_.emplace_back(new char[size]);
+    allocated_ += size;
+    dst = blocks_.back().get();
+  } else {
+    if (size > left_) {
+      blocks_.emplace_back(new char[blockBytes_]);
+      allocated_ += blockBytes_;
+      pos_ = blocks_.back().get();
+      left_ = blockBytes_;
+    }
+    dst = pos_;
+    pos_ += size;
+    left_ -= size;
+  }
+  std::memcpy(dst, data, size);
+  live_ += size;
+  return StringRef(dst, size);
+}
+
+void Arena::Free(const StringRef &s) noexcept
+{
+  live_ -= s.size;
+  garbage_ += s.size;
+}
+
+void Arena::Clear() noexcept
+{
+  blocks_.clear();
+  pos_ = nullptr;
+  left_ = 0;
+  allocated_ = 0;
+  live_ = 0;
+  garbage_ = 0;
+}
+
+void Arena::Swap(Arena &other) noexcept
+{
+  std::swap(blockBytes_, other.blockBytes_);
+  blocks_.swap(other.blocks_);
+  std::swap(pos_, other.pos_);
+  std::swap(left_, other.left_);
+  std::swap(allocated_, other.allocated_);
+  std::swap(live_, other.live_);
+  std::swap(garbage_, other.garbage_);
+}
+
+size_t Arena::AllocatedBytes() const noexcept
+{
+  return allocated_;
+}
+
+size_t Arena::LiveBytes() const noexcept
+{
+  return live_;
+}
+
+size_t Arena::GarbageBytes() const noexcept
+{
+  return garbage_;
+}
@@ -0,0 +1,107 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_ARENA_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_ARENA_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// StringRef refers to bytes owned by someone else, usually an Arena
+struct StringRef {
+  StringRef() noexcept : data(nullptr), size(0) {}
+  StringRef(const char *d, size_t n) noexcept : data(d), size(n) {}
+  // refers to s, valid as long as s is not modified
+  StringRef(const std::string &s) noexcept : data(s.data()), size(s.size()) {}
+  std::string ToString() const { return std::string(data, size); }
+  int compare(const StringRef &other) const noexcept
+  {
+    auto n = size < other.size ? size : other.size;
+    auto r = n == 0 ? 0 : std::memcmp(data, other.data, n);
+    if (r == 0) {
+      return size < other.size ? -1 : (size > other.size ? 1 : 0);
+    }
+    return r;
+  }
+  const char *data;
+  size_t size;
+};
+
+inline bool operator==(const StringRef &a, const StringRef &b) noexcept
+{
+  return a.size == b.size && (a.size == 0
+    || std::memcmp(a.data, b.data, a.size) == 0);
+}
+
+inline bool operator!=(const StringRef &a, const StringRef &b) noexcept
+{
+  return !(a == b);
+}
+
+inline bool operator<(const StringRef &a, const StringRef &b) noexcept
+{
+  return a.compare(b) < 0;
+}
+
+inline bool operator>=(const StringRef &a, const StringRef &b) noexcept
+{
+  return a.compare(b) >= 0;
+}
+
+// FNV-1a
+struct StringRefHash {
+  size_t operator()(const StringRef &s) const noexcept
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size; ++i) {
+      h = (h ^ static_cast<unsigned char>(s.data[i])) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+  }
+};
+
+// Arena packs strings into large blocks instead of one heap allocation each,
+// freed strings are only accounted as garbage and the owner reclaims them by
+// copying the live strings into a new Arena and swapping
+class Arena {
+ public:
+  explicit Arena(size_t blockBytes = 64 * 1024) noexcept;
+  // copies data into the arena
+  StringRef Add(const char *data, size_t size);
+  StringRef Add(const StringRef &s) { return Add(s.data, s.size); }
+  void Free(const StringRef &s) noexcept;
+  void Clear() noexcept;
+  void Swap(Arena &other) noexcept;
+  // bytes of all blocks
+  size_t AllocatedBytes() const noexcept;
+  // bytes of the strings added and not freed
+  size_t LiveBytes() const noexcept;
+  // bytes of the strings freed
+  size_t GarbageBytes() const noexcept;
+ private:
+  size_t blockBytes_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  // free bytes at the end of the last block
+  char *pos_;
+  size_t left_;
+  size_t allocated_;
+  size_t live_;
+  size_t garbage_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_ARENA_H_
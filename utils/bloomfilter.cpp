@@ -0,0 +1,109 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include "bloomfilter.h"
+
+BlockedBloomFilter::BlockedBloomFilter(size_t expectedKeys, size_t bitsPerKey)
+  : capacity_(std::max<size_t>(expectedKeys, 1)), added_(0)
+{
+  auto bits = capacity_ * std::max<size_t>(bitsPerKey, 1);
+  numBlocks_ = (bits + wordsPerBlock * 64 - 1) / (wordsPerBlock * 64);
+  // ln2 * bitsPerKey, blocking needs a few more bits per key than a standard
+  // filter for the same false positive rate
+  probes_ = std::min<size_t>(
+    std::max<size_t>(bitsPerKey * 69 / 100, 1), 16);
+  auto words = (numBlocks_ + 1) * wordsPerBlock;
+  memory_.reset(new std::atomic<uint64_t>[words]);
+  for (size_t i = 0; i < words; ++i) {
+    memory_[i].store(0, std::memory_order_relaxed);
+  }
+  auto addr = reinterpret_cast<uintptr_t>(memory_.get());
+  auto aligned = (addr + 63) & ~static_cast<uintptr_t>(63);
+  blocks_ = memory_.get() + (aligned - addr) / sizeof(uint64_t);
+}
+
+uint64_t BlockedBloomFilter::hash(const char *data, size_t size) noexcept
+{
+  // FNV-1a followed by the splitmix64 finalizer to spread the short keys
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+std::atomic<uint64_t> *BlockedBloomFilter::block(uint64_t h) const noexcept
+{
+  // maps the high 32 bits to [0, numBlocks_) without a division
+  auto i = ((h >> 32) * static_cast<uint64_t>(numBlocks_)) >> 32;
+  return blocks_ + i * wordsPerBlock;
+}
+
+void BlockedBloomFilter::Add(const char *data, size_t size) noexcept
+{
+  auto h = hash(data, size);
+  auto b = block(h);
+  auto h1 = static_cast<uint32_t>(h);
+  auto h2 = static_cast<uint32_t>(h >> 32) | 1;
+  for (size_t i = 0; i < probes_; ++i) {
+    auto bit = (h1 + i * h2) & (wordsPerBlock * 64 - 1);
+    b[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_release);
+  }
+  added_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool BlockedBloomFilter::MayContain(
+  const char *data,
+  size_t size) const noexcept
+{
+  auto h = hash(data, size);
+  auto b = block(h);
+  auto h1 = static_cast<uint32_t>(h);
+  auto h2 = static_cast<uint32_t>(h >> 32) | 1;
+  for (size_t i = 0; i < probes_; ++i) {
+    auto bit = (h1 + i * h2) & (wordsPerBlock * 64 - 1);
+    auto word = b[bit / 64].load(std::memory_order_acquire);
+    if ((word & (uint64_t(1) << (bit % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t BlockedBloomFilter::Capacity() const noexcept
+{
+  return capacity_;
+}
+
+size_t BlockedBloomFilter::Added() const noexcept
+{
+  return added_.load(std::memory_order_relaxed);
+}
+
+bool BlockedBloomFilter::Saturated() const noexcept
+{
+  return Added() > capacity_;
+}
+
+size_t BlockedBloomFilter::MemoryBytes() const noexcept
+{
+  return (numBlocks_ + 1) * wordsPerBlock * sizeof(uint64_t);
+}
@@ -0,0 +1,55 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_BLOOMFILTER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_BLOOMFILTER_H_
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// BlockedBloomFilter keeps all bits of a key in one 64-byte block so that a
+// lookup touches a single cache line, keys can be added concurrently with
+// lookups but never removed, deleted keys keep answering MayContain until the
+// filter is rebuilt
+class BlockedBloomFilter {
+ public:
+  // sized for expectedKeys at bitsPerKey, the false positive rate grows once
+  // more keys are added
+  explicit BlockedBloomFilter(size_t expectedKeys, size_t bitsPerKey = 10);
+  void Add(const char *data, size_t size) noexcept;
+  // false if the key was definitely never added
+  bool MayContain(const char *data, size_t size) const noexcept;
+  size_t Capacity() const noexcept;
+  // keys added, including duplicates
+  size_t Added() const noexcept;
+  // true once more keys were added than the filter was sized for
+  bool Saturated() const noexcept;
+  size_t MemoryBytes() const noexcept;
+ private:
+  static constexpr size_t wordsPerBlock = 8;
+  static uint64_t hash(const char *data, size_t size) noexcept;
+  std::atomic<uint64_t> *block(uint64_t h) const noexcept;
+  const size_t capacity_;
+  size_t numBlocks_;
+  size_t probes_;
+  // over-allocated by one block to align blocks_ to the cache line
+  std::unique_ptr<std::atomic<uint64_t>[]> memory_;
+  std::atomic<uint64_t> *blocks_;
+  std::atomic<size_t> added_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_BLOOMFILTER_H_
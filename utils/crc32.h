@@ -0,0 +1,24 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_CRC32_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3) of data, pass the previous result as crc to extend it
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0) noexcept;
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_CRC32_H_
@@ -0,0 +1,111 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+#include "histogram.h"
+
+// bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+static size_t bucketOf(uint64_t value) noexcept
+{
+  size_t idx = 0;
+  while (value != 0) {
+    value >>= 1;
+    idx++;
+  }
+  return idx;
+}
+
+static uint64_t upperBoundOf(size_t bucket) noexcept
+{
+  if (bucket == 0) {
+    return 0;
+  }
+  if (bucket >= 64) {
+    return UINT64_MAX;
+  }
+  return (uint64_t(1) << bucket) - 1;
+}
+
+Histogram::Histogram() noexcept
+  : count_(0), sum_(0), max_(0)
+{
+  for (auto &b : buckets_) {
+    b.store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::Record(uint64_t value) noexcept
+{
+  buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  auto max = max_.load(std::memory_order_relaxed);
+  while (value > max
+    && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t Histogram::Count() const noexcept
+{
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Sum() const noexcept
+{
+  return sum_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Max() const noexcept
+{
+  return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Percentile(double p) const noexcept
+{
+  uint64_t counts[BUCKETS];
+  uint64_t total = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  auto rank = static_cast<uint64_t>(total * p / 100.0);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      auto bound = upperBoundOf(i);
+      auto max = Max();
+      return bound < max ? bound : max;
+    }
+  }
+  return Max();
+}
+
+std::string Histogram::ToString() const
+{
+  std::stringstream ss;
+  auto count = Count();
+  ss << "count=" << count
+     << " avg=" << (count == 0 ? 0 : Sum() / count)
+     << " p50=" << Percentile(50)
+     << " p99=" << Percentile(99)
+     << " max=" << Max();
+  return ss.str();
+}
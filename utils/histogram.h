@@ -0,0 +1,43 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_HISTOGRAM_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_HISTOGRAM_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+// Histogram records samples into power-of-two buckets, Record and the getters
+// can be concurrently invoked
+class Histogram {
+ public:
+  Histogram() noexcept;
+  void Record(uint64_t value) noexcept;
+  uint64_t Count() const noexcept;
+  uint64_t Sum() const noexcept;
+  uint64_t Max() const noexcept;
+  // returns the upper bound of the bucket holding the p-th (0 < p <= 100)
+  // percentile, 0 if there is no sample
+  uint64_t Percentile(double p) const noexcept;
+  std::string ToString() const;
+ private:
+  static const size_t BUCKETS = 65;
+  std::atomic<uint64_t> buckets_[BUCKETS];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_HISTOGRAM_H_
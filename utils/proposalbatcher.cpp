@@ -0,0 +1,238 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include "proposalbatcher.h"
+
+static uint64_t nowMicros() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool isBatch(const char *data, size_t size) noexcept
+{
+  return size >= batchMagic.size()
+    && memcmp(data, batchMagic.data(), batchMagic.size()) == 0;
+}
+
+size_t maxBatchCommands(size_t resultBits) noexcept
+{
+  return 64 / std::max<size_t>(resultBits, 1);
+}
+
+bool decodeBatch(
+  const char *data,
+  size_t size,
+  size_t maxCommands,
+  std::vector<std::string> *commands)
+{
+  std::vector<StringRef> refs;
+  if (!decodeBatch(data, size, maxCommands, &refs)) {
+    return false;
+  }
+  commands->clear();
+  for (auto &ref : refs) {
+    commands->emplace_back(ref.data, ref.size);
+  }
+  return true;
+}
+
+bool decodeBatch(
+  const char *data,
+  size_t size,
+  size_t maxCommands,
+  std::vector<StringRef> *commands)
+{
+  commands->clear();
+  if (!isBatch(data, size)) {
+    return false;
+  }
+  size_t pos = batchMagic.size();
+  while (pos < size) {
+    uint32_t len;
+    if (size - pos < sizeof(len)) {
+      commands->clear();
+      return false;
+    }
+    memcpy(&len, data + pos, sizeof(len));
+    pos += sizeof(len);
+    if (size - pos < len || commands->size() == maxCommands) {
+      commands->clear();
+      return false;
+    }
+    commands->emplace_back(data + pos, len);
+    pos += len;
+  }
+  return !commands->empty();
+}
+
+void appendToBatch(const std::string &cmd, std::string *batch)
+{
+  if (batch->empty()) {
+    batch->assign(batchMagic);
+  }
+  auto len = static_cast<uint32_t>(cmd.size());
+  batch->append(reinterpret_cast<const char *>(&len), sizeof(len));
+  batch->append(cmd);
+}
+
+static uint64_t resultMask(size_t resultBits) noexcept
+{
+  return resultBits >= 64 ? UINT64_MAX : (uint64_t(1) << resultBits) - 1;
+}
+
+uint64_t packBatchResult(
+  uint64_t packed,
+  size_t i,
+  size_t resultBits,
+  uint64_t result) noexcept
+{
+  if (i >= maxBatchCommands(resultBits)) {
+    return packed;
+  }
+  auto mask = resultMask(resultBits);
+  return packed | ((result & mask) << (i * resultBits));
+}
+
+uint64_t unpackBatchResult(
+  uint64_t packed,
+  size_t i,
+  size_t resultBits) noexcept
+{
+  if (i >= maxBatchCommands(resultBits)) {
+    return 0;
+  }
+  return (packed >> (i * resultBits)) & resultMask(resultBits);
+}
+
+ProposalBatcher::ProposalBatcher(
+  dragonboat::NodeHost *nh,
+  uint64_t clusterID,
+  const ProposalBatcherOptions &options)
+  : nh_(nh), options_(options),
+    maxCommands_(maxBatchCommands(options.resultBits)),
+    session_(nh->GetNoOPSession(clusterID)), queuedBytes_(0),
+    stopped_(false)
+{
+  flusher_ = std::thread([this]()
+  {
+    run();
+  });
+}
+
+ProposalBatcher::~ProposalBatcher()
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    stopped_ = true;
+  }
+  queued_.notify_one();
+  flusher_.join();
+}
+
+dragonboat::Status ProposalBatcher::Propose(
+  const std::string &cmd,
+  uint64_t *result)
+{
+  Pending p;
+  p.cmd = &cmd;
+  p.done = false;
+  p.result = 0;
+  p.queuedMicros = nowMicros();
+  std::unique_lock<std::mutex> lk(mtx_);
+  queue_.push_back(&p);
+  queuedBytes_ += cmd.size();
+  queued_.notify_one();
+  applied_.wait(lk, [&p]()
+  {
+    return p.done;
+  });
+  *result = p.result;
+  return p.status;
+}
+
+std::string ProposalBatcher::ToString() const
+{
+  std::stringstream ss;
+  ss << "commands_per_entry: " << commands_.ToString() << "\n"
+     << "propose_us: " << proposeMicros_.ToString();
+  return ss.str();
+}
+
+std::vector<ProposalBatcher::Pending *> ProposalBatcher::nextBatch()
+{
+  std::vector<Pending *> batch;
+  size_t bytes = 0;
+  while (!queue_.empty() && batch.size() < maxCommands_) {
+    auto size = queue_.front()->cmd->size();
+    if (!batch.empty() && bytes + size > options_.maxBytes) {
+      break;
+    }
+    bytes += size;
+    batch.push_back(queue_.front());
+    queue_.pop_front();
+  }
+  queuedBytes_ -= bytes;
+  return batch;
+}
+
+void ProposalBatcher::run()
+{
+  std::unique_lock<std::mutex> lk(mtx_);
+  std::string entry;
+  while (true) {
+    queued_.wait(lk, [this]()
+    {
+      return stopped_ || !queue_.empty();
+    });
+    if (queue_.empty()) {
+      return;
+    }
+    // lingers for more commands unless the oldest one has waited long enough
+    auto deadline = std::chrono::steady_clock::time_point(
+      std::chrono::microseconds(
+        queue_.front()->queuedMicros + options_.lingerMicros));
+    queued_.wait_until(lk, deadline, [this]()
+    {
+      return stopped_ || queuedBytes_ >= options_.maxBytes
+        || queue_.size() >= maxCommands_;
+    });
+    auto batch = nextBatch();
+    lk.unlock();
+    entry.clear();
+    for (auto p : batch) {
+      appendToBatch(*p->cmd, &entry);
+    }
+    dragonboat::Buffer buf(
+      reinterpret_cast<const dragonboat::Byte *>(entry.data()), entry.size());
+    dragonboat::UpdateResult packed = 0;
+    auto start = nowMicros();
+    auto status =
+      nh_->SyncPropose(session_.get(), buf, options_.timeout, &packed);
+    proposeMicros_.Record(nowMicros() - start);
+    commands_.Record(batch.size());
+    lk.lock();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i]->status = status;
+      batch[i]->result = unpackBatchResult(packed, i, options_.resultBits);
+      batch[i]->done = true;
+    }
+    applied_.notify_all();
+  }
+}
@@ -0,0 +1,120 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_PROPOSALBATCHER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_PROPOSALBATCHER_H_
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include "dragonboat/dragonboat.h"
+#include "histogram.h"
+#include "arena.h"
+
+// a batch entry carries several commands in one Raft entry: batchMagic
+// followed by (uint32 length, command) records, the magic starts with a NUL
+// so that it never collides with a text command
+const std::string batchMagic("\0CMB", 4);
+
+bool isBatch(const char *data, size_t size) noexcept;
+// the commands a batch entry may hold when each result keeps resultBits
+size_t maxBatchCommands(size_t resultBits) noexcept;
+// returns false if the batch is malformed or holds more than maxCommands
+// commands, the entry is then rejected as a whole
+bool decodeBatch(
+  const char *data,
+  size_t size,
+  size_t maxCommands,
+  std::vector<std::string> *commands);
+// same as above, commands refer to data
+bool decodeBatch(
+  const char *data,
+  size_t size,
+  size_t maxCommands,
+  std::vector<StringRef> *commands);
+// starts batch with batchMagic if it is empty and appends cmd to it
+void appendToBatch(const std::string &cmd, std::string *batch);
+
+// the result of a batch entry packs the result of the i-th command into bits
+// [i * resultBits, (i + 1) * resultBits), the results of commands beyond
+// maxBatchCommands(resultBits) are dropped
+uint64_t packBatchResult(
+  uint64_t packed,
+  size_t i,
+  size_t resultBits,
+  uint64_t result) noexcept;
+uint64_t unpackBatchResult(
+  uint64_t packed,
+  size_t i,
+  size_t resultBits) noexcept;
+
+struct ProposalBatcherOptions {
+  // a batch is proposed once it reaches maxBytes of commands or lingerMicros
+  // after its first command arrived
+  size_t maxBytes = 64 * 1024;
+  uint64_t lingerMicros = 200;
+  // bits of the per-command result kept by the state machine
+  size_t resultBits = 1;
+  dragonboat::Milliseconds timeout = dragonboat::Milliseconds(3000);
+};
+
+// ProposalBatcher coalesces the commands proposed concurrently to a cluster
+// into batch entries, one entry is proposed at a time and the commands
+// arriving meanwhile form the next one
+class ProposalBatcher {
+ public:
+  ProposalBatcher(
+    dragonboat::NodeHost *nh,
+    uint64_t clusterID,
+    const ProposalBatcherOptions &options = ProposalBatcherOptions());
+  // proposes the pending commands before returning
+  ~ProposalBatcher();
+  // blocks until the entry carrying cmd is applied, result is the result of
+  // cmd truncated to resultBits
+  dragonboat::Status Propose(const std::string &cmd, uint64_t *result);
+  std::string ToString() const;
+ private:
+  struct Pending {
+    const std::string *cmd;
+    bool done;
+    dragonboat::Status status;
+    uint64_t result;
+    // steady clock microseconds
+    uint64_t queuedMicros;
+  };
+  void run();
+  // takes the commands of the next entry off queue_, mtx_ must be held
+  std::vector<Pending *> nextBatch();
+  dragonboat::NodeHost *nh_;
+  const ProposalBatcherOptions options_;
+  const size_t maxCommands_;
+  std::unique_ptr<dragonboat::Session> session_;
+  std::mutex mtx_;
+  std::condition_variable queued_;
+  std::condition_variable applied_;
+  std::deque<Pending *> queue_;
+  size_t queuedBytes_;
+  bool stopped_;
+  Histogram commands_;
+  Histogram proposeMicros_;
+  std::thread flusher_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_PROPOSALBATCHER_H_
@@ -0,0 +1,112 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <condition_variable>
+#include "readcoordinator.h"
+
+class ReadCoordinator::Window : public dragonboat::Event {
+ public:
+  Window() noexcept : readers(0), done_(false), completed_(false)
+  {}
+  // blocks until the ReadIndex completed or failed, returns true if the
+  // local node has applied the read index
+  bool Wait() noexcept
+  {
+    std::unique_lock<std::mutex> lk(mtx_);
+    cv_.wait(lk, [this]()
+    {
+      return done_;
+    });
+    return completed_;
+  }
+  void Fail() noexcept
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    done_ = true;
+    cv_.notify_all();
+  }
+  // protected by ReadCoordinator::mtx_ until the window is closed
+  uint64_t readers;
+ protected:
+  void set() noexcept override
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    done_ = true;
+    completed_ = Get().code == RequestCompleted;
+    cv_.notify_all();
+  }
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool done_;
+  bool completed_;
+};
+
+ReadCoordinator::ReadCoordinator(
+  dragonboat::NodeHost *nh,
+  const ReadCoordinatorOptions &options)
+  : nh_(nh), options_(options), reads_(0), fallbacks_(0)
+{
+}
+
+dragonboat::Status ReadCoordinator::Read(
+  uint64_t clusterID,
+  const dragonboat::Buffer &query,
+  dragonboat::Buffer *result)
+{
+  reads_++;
+  std::shared_ptr<Window> window;
+  bool first = false;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    auto &open = open_[clusterID];
+    if (!open) {
+      open = std::make_shared<Window>();
+      first = true;
+    }
+    open->readers++;
+    window = open;
+  }
+  if (first) {
+    std::this_thread::sleep_for(
+      std::chrono::microseconds(options_.windowMicros));
+    {
+      std::lock_guard<std::mutex> guard(mtx_);
+      open_[clusterID].reset();
+      readsPerIndex_.Record(window->readers);
+    }
+    auto status = nh_->ReadIndex(clusterID, options_.timeout, window.get());
+    if (!status.OK()) {
+      window->Fail();
+    }
+  }
+  if (!window->Wait()) {
+    fallbacks_++;
+    return nh_->SyncRead(clusterID, query, result, options_.timeout);
+  }
+  return nh_->ReadLocalNode(clusterID, query, result);
+}
+
+std::string ReadCoordinator::ToString() const
+{
+  std::stringstream ss;
+  ss << "reads: " << reads_.load() << "\n"
+     << "fallbacks: " << fallbacks_.load() << "\n"
+     << "reads_per_index: " << readsPerIndex_.ToString();
+  return ss.str();
+}
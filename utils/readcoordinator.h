@@ -0,0 +1,63 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_READCOORDINATOR_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_READCOORDINATOR_H_
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include "dragonboat/dragonboat.h"
+#include "histogram.h"
+
+struct ReadCoordinatorOptions {
+  // reads arriving within windowMicros of the first one share its ReadIndex
+  uint64_t windowMicros = 100;
+  dragonboat::Milliseconds timeout = dragonboat::Milliseconds(3000);
+};
+
+// ReadCoordinator serves linearizable reads with one ReadIndex per window of
+// concurrent reads of a cluster instead of one per read. The first read of a
+// window waits windowMicros, requests the ReadIndex and the reads of the
+// window then look up the local node once it has applied the read index.
+// Every ReadIndex is requested after the reads it serves arrived, so a read
+// observes all the writes completed before it started.
+class ReadCoordinator {
+ public:
+  ReadCoordinator(
+    dragonboat::NodeHost *nh,
+    const ReadCoordinatorOptions &options = ReadCoordinatorOptions());
+  // same as NodeHost::SyncRead, falls back to it if the ReadIndex failed
+  dragonboat::Status Read(
+    uint64_t clusterID,
+    const dragonboat::Buffer &query,
+    dragonboat::Buffer *result);
+  std::string ToString() const;
+ private:
+  class Window;
+  dragonboat::NodeHost *nh_;
+  const ReadCoordinatorOptions options_;
+  std::mutex mtx_;
+  // the window collecting reads of each cluster, nullptr once closed
+  std::unordered_map<uint64_t, std::shared_ptr<Window>> open_;
+  std::atomic<uint64_t> reads_;
+  std::atomic<uint64_t> fallbacks_;
+  Histogram readsPerIndex_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_READCOORDINATOR_H_
@@ -0,0 +1,339 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include "snapshotstream.h"
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const char streamMagic[] = {'D', 'B', 'S', 'S'};
+const char streamVersion = 1;
+constexpr size_t blockSize = 256 * 1024;
+// refuse frames a corrupted header claims to be larger than this
+constexpr uint32_t maxBlockSize = 64 * 1024 * 1024;
+constexpr int zstdLevel = 3;
+
+uint64_t nowMicros() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// returns the compressed size, 0 if the block does not compress
+size_t compressBlock(
+  SnapshotCodec codec,
+  const std::string &block,
+  std::string *out)
+{
+  switch (codec) {
+#ifdef HAVE_LZ4
+    case CODEC_LZ4: {
+      out->resize(LZ4_compressBound(static_cast<int>(block.size())));
+      int n = LZ4_compress_default(
+        block.data(), &(*out)[0],
+        static_cast<int>(block.size()), static_cast<int>(out->size()));
+      return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD: {
+      out->resize(ZSTD_compressBound(block.size()));
+      size_t n = ZSTD_compress(
+        &(*out)[0], out->size(), block.data(), block.size(), zstdLevel);
+      return ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+    default:return 0;
+  }
+}
+
+bool decompressBlock(
+  SnapshotCodec codec,
+  const std::string &in,
+  std::string *block)
+{
+  switch (codec) {
+#ifdef HAVE_LZ4
+    case CODEC_LZ4: {
+      int n = LZ4_decompress_safe(
+        in.data(), &(*block)[0],
+        static_cast<int>(in.size()), static_cast<int>(block->size()));
+      return n >= 0 && static_cast<size_t>(n) == block->size();
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD: {
+      size_t n = ZSTD_decompress(
+        &(*block)[0], block->size(), in.data(), in.size());
+      return !ZSTD_isError(n) && n == block->size();
+    }
+#endif
+    default:return false;
+  }
+}
+
+} // namespace
+
+bool ParseSnapshotCodec(const std::string &name, SnapshotCodec *codec)
+{
+  SnapshotCodec parsed;
+  if (name == "none") {
+    parsed = CODEC_NONE;
+  } else if (name == "lz4") {
+    parsed = CODEC_LZ4;
+  } else if (name == "zstd") {
+    parsed = CODEC_ZSTD;
+  } else {
+    return false;
+  }
+  if (!SnapshotCodecSupported(parsed)) {
+    return false;
+  }
+  *codec = parsed;
+  return true;
+}
+
+const char *SnapshotCodecName(SnapshotCodec codec)
+{
+  switch (codec) {
+    case CODEC_NONE:return "none";
+    case CODEC_LZ4:return "lz4";
+    case CODEC_ZSTD:return "zstd";
+    default:return "unknown";
+  }
+}
+
+bool SnapshotCodecSupported(SnapshotCodec codec)
+{
+  switch (codec) {
+    case CODEC_NONE:return true;
+#ifdef HAVE_LZ4
+    case CODEC_LZ4:return true;
+#endif
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:return true;
+#endif
+    default:return false;
+  }
+}
+
+SnapshotStreamWriter::SnapshotStreamWriter(Sink sink, SnapshotCodec codec)
+  : sink_(std::move(sink)),
+    codec_(SnapshotCodecSupported(codec) ? codec : CODEC_NONE),
+    headerWritten_(false), raw_(0), stored_(0), startMicros_(nowMicros())
+{
+  block_.reserve(blockSize);
+}
+
+bool SnapshotStreamWriter::Write(const char *data, size_t size)
+{
+  if (!headerWritten_ && !writeHeader()) {
+    return false;
+  }
+  while (size > 0) {
+    auto n = std::min(size, blockSize - block_.size());
+    block_.append(data, n);
+    data += n;
+    size -= n;
+    raw_ += n;
+    if (block_.size() == blockSize && !flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SnapshotStreamWriter::Close()
+{
+  if (!headerWritten_ && !writeHeader()) {
+    return false;
+  }
+  if (!block_.empty() && !flush()) {
+    return false;
+  }
+  uint32_t end[2] = {0, 0};
+  stored_ += sizeof(end);
+  return sink_(reinterpret_cast<const char *>(end), sizeof(end));
+}
+
+SnapshotCodec SnapshotStreamWriter::Codec() const noexcept
+{
+  return codec_;
+}
+
+uint64_t SnapshotStreamWriter::RawBytes() const noexcept
+{
+  return raw_;
+}
+
+uint64_t SnapshotStreamWriter::StoredBytes() const noexcept
+{
+  return stored_;
+}
+
+std::string SnapshotStreamWriter::ToString() const
+{
+  std::stringstream ss;
+  ss << "codec=" << SnapshotCodecName(codec_)
+     << " raw=" << raw_
+     << " stored=" << stored_
+     << " ratio=" << (stored_ == 0 ? 0.0 : static_cast<double>(raw_) / stored_)
+     << " ms=" << (nowMicros() - startMicros_) / 1000;
+  return ss.str();
+}
+
+bool SnapshotStreamWriter::writeHeader()
+{
+  headerWritten_ = true;
+  std::string header(streamMagic, sizeof(streamMagic));
+  header.push_back(streamVersion);
+  header.push_back(static_cast<char>(codec_));
+  stored_ += header.size();
+  return sink_(header.data(), header.size());
+}
+
+bool SnapshotStreamWriter::flush()
+{
+  size_t n = compressBlock(codec_, block_, &compressed_);
+  bool compressed = n != 0 && n < block_.size();
+  uint32_t frame[2] = {
+    static_cast<uint32_t>(block_.size()),
+    static_cast<uint32_t>(compressed ? n : block_.size()),
+  };
+  stored_ += sizeof(frame) + frame[1];
+  bool ok = sink_(reinterpret_cast<const char *>(frame), sizeof(frame))
+    && sink_(compressed ? compressed_.data() : block_.data(), frame[1]);
+  block_.clear();
+  return ok;
+}
+
+SnapshotStreamReader::SnapshotStreamReader(Source source)
+  : source_(std::move(source)), codec_(CODEC_NONE), headerRead_(false),
+    framed_(false), ended_(false), failed_(false), offset_(0)
+{
+}
+
+int64_t SnapshotStreamReader::Read(char *data, size_t size)
+{
+  if (!failed_ && !headerRead_ && !readHeader()) {
+    failed_ = true;
+  }
+  if (failed_) {
+    return -1;
+  }
+  size_t copied = 0;
+  while (copied < size) {
+    if (offset_ < block_.size()) {
+      auto n = std::min(size - copied, block_.size() - offset_);
+      memcpy(data + copied, block_.data() + offset_, n);
+      offset_ += n;
+      copied += n;
+      continue;
+    }
+    if (!framed_) {
+      auto n = readSource(data + copied, size - copied);
+      if (n < 0) {
+        failed_ = true;
+        return -1;
+      }
+      copied += n;
+      break;
+    }
+    if (ended_) {
+      break;
+    }
+    if (!readFrame()) {
+      failed_ = true;
+      return -1;
+    }
+  }
+  return static_cast<int64_t>(copied);
+}
+
+SnapshotCodec SnapshotStreamReader::Codec() const noexcept
+{
+  return codec_;
+}
+
+bool SnapshotStreamReader::readHeader()
+{
+  headerRead_ = true;
+  char header[sizeof(streamMagic) + 2];
+  auto n = readSource(header, sizeof(streamMagic));
+  if (n < 0) {
+    return false;
+  }
+  if (n < static_cast<int64_t>(sizeof(streamMagic))
+    || memcmp(header, streamMagic, sizeof(streamMagic)) != 0) {
+    // a snapshot without the compression layer
+    block_.assign(header, n);
+    return true;
+  }
+  if (readSource(header + sizeof(streamMagic), 2) != 2
+    || header[sizeof(streamMagic)] != streamVersion) {
+    return false;
+  }
+  framed_ = true;
+  codec_ = static_cast<SnapshotCodec>(header[sizeof(streamMagic) + 1]);
+  return SnapshotCodecSupported(codec_);
+}
+
+bool SnapshotStreamReader::readFrame()
+{
+  uint32_t frame[2];
+  if (readSource(reinterpret_cast<char *>(frame), sizeof(frame))
+    != static_cast<int64_t>(sizeof(frame))) {
+    return false;
+  }
+  if (frame[0] == 0) {
+    ended_ = true;
+    return true;
+  }
+  if (frame[0] > maxBlockSize || frame[1] > frame[0]) {
+    return false;
+  }
+  block_.resize(frame[0]);
+  offset_ = 0;
+  if (frame[1] == frame[0]) {
+    return readSource(&block_[0], frame[0]) == frame[0];
+  }
+  compressed_.resize(frame[1]);
+  return readSource(&compressed_[0], frame[1]) == frame[1]
+    && decompressBlock(codec_, compressed_, &block_);
+}
+
+int64_t SnapshotStreamReader::readSource(char *data, size_t size)
+{
+  size_t total = 0;
+  while (total < size) {
+    auto n = source_(data + total, size - total);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+  }
+  return static_cast<int64_t>(total);
+}
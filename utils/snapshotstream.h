@@ -0,0 +1,93 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_SNAPSHOTSTREAM_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_SNAPSHOTSTREAM_H_
+
+#include <string>
+#include <cstdint>
+#include <functional>
+
+// block compression applied to a snapshot, recorded in the stream header
+enum SnapshotCodec : uint8_t {
+  CODEC_NONE = 0,
+  CODEC_LZ4 = 1,
+  CODEC_ZSTD = 2,
+};
+
+// parses none, lz4 or zstd, returns false for unknown or not compiled in codecs
+bool ParseSnapshotCodec(const std::string &name, SnapshotCodec *codec);
+const char *SnapshotCodecName(SnapshotCodec codec);
+bool SnapshotCodecSupported(SnapshotCodec codec);
+
+// SnapshotStreamWriter compresses the snapshot in blocks, the stream is
+// "DBSS" version codec, then (rawLen, storedLen, block) frames with native
+// uint32 lengths, a block is stored as is when storedLen == rawLen, and a
+// frame with rawLen 0 ends the stream
+class SnapshotStreamWriter {
+ public:
+  // writes size bytes to the underlying SnapshotWriter, false on error
+  using Sink = std::function<bool(const char *, size_t)>;
+  // falls back to CODEC_NONE if codec is not compiled in
+  SnapshotStreamWriter(Sink sink, SnapshotCodec codec);
+  bool Write(const char *data, size_t size);
+  // flushes the last block and ends the stream
+  bool Close();
+  SnapshotCodec Codec() const noexcept;
+  uint64_t RawBytes() const noexcept;
+  uint64_t StoredBytes() const noexcept;
+  // codec, raw and stored bytes, ratio and the time since construction
+  std::string ToString() const;
+ private:
+  bool writeHeader();
+  bool flush();
+  Sink sink_;
+  SnapshotCodec codec_;
+  std::string block_;
+  std::string compressed_;
+  bool headerWritten_;
+  uint64_t raw_;
+  uint64_t stored_;
+  uint64_t startMicros_;
+};
+
+// SnapshotStreamReader decompresses a stream written by SnapshotStreamWriter,
+// streams without the header are returned as is so that snapshots taken
+// before the compression layer can still be recovered
+class SnapshotStreamReader {
+ public:
+  // reads up to size bytes from the underlying SnapshotReader, returns the
+  // bytes read, 0 at the end and -1 on error
+  using Source = std::function<int64_t(char *, size_t)>;
+  explicit SnapshotStreamReader(Source source);
+  // fills data unless the stream ends, returns the bytes read, 0 at the end
+  // and -1 on error
+  int64_t Read(char *data, size_t size);
+  SnapshotCodec Codec() const noexcept;
+ private:
+  bool readHeader();
+  bool readFrame();
+  int64_t readSource(char *data, size_t size);
+  Source source_;
+  SnapshotCodec codec_;
+  bool headerRead_;
+  bool framed_;
+  bool ended_;
+  bool failed_;
+  std::string block_;
+  size_t offset_;
+  std::string compressed_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_SNAPSHOTSTREAM_H_
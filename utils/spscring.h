@@ -0,0 +1,97 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_SPSCRING_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_SPSCRING_H_
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// SPSCRing is a bounded lock-free queue for one producer thread and one
+// consumer thread, the head and the tail are kept on separate cache lines and
+// each side caches the index owned by the other to avoid touching its line
+// on every operation
+template<typename T>
+class SPSCRing {
+ public:
+  // the capacity is rounded up to a power of two
+  explicit SPSCRing(size_t capacity)
+    : slots_(roundUp(capacity)), mask_(slots_.size() - 1), head_(0),
+      cachedTail_(0), tail_(0), cachedHead_(0)
+  {}
+  // producer only, returns false if the ring is full
+  bool TryPush(T &&item)
+  {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cachedHead_ == slots_.size()) {
+      cachedHead_ = head_.load(std::memory_order_acquire);
+      if (tail - cachedHead_ == slots_.size()) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  // consumer only, returns false if the ring is empty
+  bool TryPop(T *item)
+  {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == cachedTail_) {
+      cachedTail_ = tail_.load(std::memory_order_acquire);
+      if (head == cachedTail_) {
+        return false;
+      }
+    }
+    *item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  // approximate unless called by the consumer
+  bool Empty() const noexcept
+  {
+    return head_.load(std::memory_order_acquire)
+      == tail_.load(std::memory_order_acquire);
+  }
+  size_t Capacity() const noexcept
+  {
+    return slots_.size();
+  }
+ private:
+  static constexpr size_t cacheLine = 64;
+  static size_t roundUp(size_t capacity) noexcept
+  {
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    return n;
+  }
+  std::vector<T> slots_;
+  const size_t mask_;
+  char pad0_[cacheLine];
+  // written by the consumer
+  std::atomic<size_t> head_;
+  size_t cachedTail_;
+  char pad1_[cacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  // written by the producer
+  std::atomic<size_t> tail_;
+  size_t cachedHead_;
+  char pad2_[cacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_SPSCRING_H_
@@ -0,0 +1,122 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include "stalereader.h"
+
+static uint64_t nowMillis() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string encodeAppliedState(const AppliedState &state)
+{
+  return std::to_string(state.index) + " " + std::to_string(state.timeMillis);
+}
+
+bool decodeAppliedState(const char *data, size_t size, AppliedState *state)
+{
+  std::string str(data, size);
+  char *end = nullptr;
+  errno = 0;
+  state->index = std::strtoull(str.c_str(), &end, 10);
+  if (errno != 0 || *end != ' ') {
+    return false;
+  }
+  state->timeMillis = std::strtoull(end + 1, &end, 10);
+  return errno == 0 && *end == '\0';
+}
+
+StaleReader::StaleReader(
+  dragonboat::NodeHost *nh,
+  dragonboat::Milliseconds timeout,
+  ReadCoordinator *coordinator)
+  : nh_(nh), timeout_(timeout), coordinator_(coordinator), localReads_(0),
+    linearizableReads_(0)
+{
+}
+
+dragonboat::Status StaleReader::Read(
+  uint64_t clusterID,
+  const dragonboat::Buffer &query,
+  dragonboat::Buffer *result,
+  uint64_t maxStalenessMillis,
+  bool *stale)
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    lastReads_[clusterID] = nowMillis();
+  }
+  // the local state only moves forward, so the query result is at most as
+  // stale as the applied state read before it
+  if (Staleness(clusterID) <= maxStalenessMillis) {
+    auto status = nh_->StaleRead(clusterID, query, result);
+    if (status.OK()) {
+      localReads_++;
+      if (stale != nullptr) {
+        *stale = true;
+      }
+      return status;
+    }
+  }
+  linearizableReads_++;
+  if (stale != nullptr) {
+    *stale = false;
+  }
+  if (coordinator_ != nullptr) {
+    return coordinator_->Read(clusterID, query, result);
+  }
+  return nh_->SyncRead(clusterID, query, result, timeout_);
+}
+
+uint64_t StaleReader::Staleness(uint64_t clusterID)
+{
+  dragonboat::Buffer query(
+    reinterpret_cast<const dragonboat::Byte *>(appliedQuery.data()),
+    appliedQuery.size());
+  dragonboat::Buffer result(64);
+  AppliedState state;
+  auto status = nh_->StaleRead(clusterID, query, &result);
+  if (!status.OK() || !decodeAppliedState(
+    reinterpret_cast<const char *>(result.Data()), result.Len(), &state)
+    || state.timeMillis == 0) {
+    return UINT64_MAX;
+  }
+  uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  return now > state.timeMillis ? now - state.timeMillis : 0;
+}
+
+uint64_t StaleReader::SinceLastRead(uint64_t clusterID)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  auto it = lastReads_.find(clusterID);
+  if (it == lastReads_.end()) {
+    return UINT64_MAX;
+  }
+  return nowMillis() - it->second;
+}
+
+std::string StaleReader::ToString() const
+{
+  std::stringstream ss;
+  ss << "local_reads: " << localReads_.load() << "\n"
+     << "linearizable_reads: " << linearizableReads_.load();
+  return ss.str();
+}
@@ -0,0 +1,82 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_STALEREADER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_STALEREADER_H_
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include "dragonboat/dragonboat.h"
+#include "readcoordinator.h"
+#include "utils.h"
+
+// the state machines answer appliedQuery with their applied state encoded
+// as "index time", time is the Raft-applied time, the largest tick applied
+// in unix milliseconds, or 0 if no tick has been applied
+const std::string appliedQuery = taggedQuery("applied");
+// the clusters are ticked for this long after their last stale read
+constexpr uint64_t staleReadDemandMillis = 60000;
+
+struct AppliedState {
+  uint64_t index;
+  uint64_t timeMillis;
+};
+
+std::string encodeAppliedState(const AppliedState &state);
+// returns false if data is not an encoded applied state
+bool decodeAppliedState(const char *data, size_t size, AppliedState *state);
+
+// StaleReader serves reads from the local node without contacting the other
+// replicas as long as the Raft-applied time of the local state machine is
+// within the staleness bound of the caller, otherwise the read goes through
+// the linearizable path. The bound assumes the clocks of the nodes proposing
+// the ticks and of the reader are roughly synchronized, and a local read may
+// additionally miss up to one tick interval of writes.
+class StaleReader {
+ public:
+  // linearizable reads go through coordinator unless it is nullptr
+  StaleReader(
+    dragonboat::NodeHost *nh,
+    dragonboat::Milliseconds timeout,
+    ReadCoordinator *coordinator = nullptr);
+  // stale is set to true if the read was served by the local node
+  dragonboat::Status Read(
+    uint64_t clusterID,
+    const dragonboat::Buffer &query,
+    dragonboat::Buffer *result,
+    uint64_t maxStalenessMillis,
+    bool *stale = nullptr);
+  // returns the staleness in milliseconds of the local state machine,
+  // UINT64_MAX if unknown
+  uint64_t Staleness(uint64_t clusterID);
+  // returns the milliseconds since the last Read of the cluster, UINT64_MAX
+  // if it was never read
+  uint64_t SinceLastRead(uint64_t clusterID);
+  std::string ToString() const;
+ private:
+  dragonboat::NodeHost *nh_;
+  const dragonboat::Milliseconds timeout_;
+  ReadCoordinator *coordinator_;
+  std::atomic<uint64_t> localReads_;
+  std::atomic<uint64_t> linearizableReads_;
+  std::mutex mtx_;
+  // steady clock milliseconds of the last Read of each cluster
+  std::unordered_map<uint64_t, uint64_t> lastReads_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_STALEREADER_H_
@@ -0,0 +1,379 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_STATEMACHINEBASE_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_STATEMACHINEBASE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <initializer_list>
+#include "dragonboat/statemachine/regular.h"
+#include "snapshotstream.h"
+#include "proposalbatcher.h"
+#include "arena.h"
+
+// FNV-1a of a command verb, constexpr so that it can be computed at compile
+// time for the verbs of a command table
+constexpr uint64_t commandHash(
+  const char *verb,
+  uint64_t h = 14695981039346656037ULL)
+{
+  return *verb == '\0' ? h : commandHash(
+    verb + 1, (h ^ static_cast<unsigned char>(*verb)) * 1099511628211ULL);
+}
+
+inline uint64_t commandHash(const StringRef &verb) noexcept
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < verb.size; ++i) {
+    h = (h ^ static_cast<unsigned char>(verb.data[i])) * 1099511628211ULL;
+  }
+  return h;
+}
+
+// CommandArgs splits a command into space separated tokens referring to the
+// command bytes, the first token is the verb
+class CommandArgs {
+ public:
+  void Parse(const char *data, size_t size, uint64_t index)
+  {
+    raw_ = StringRef(data, size);
+    index_ = index;
+    tokens_.clear();
+    size_t pos = 0;
+    while (pos < size) {
+      while (pos < size && data[pos] == ' ') {
+        pos++;
+      }
+      auto start = pos;
+      while (pos < size && data[pos] != ' ') {
+        pos++;
+      }
+      if (pos > start) {
+        tokens_.emplace_back(data + start, pos - start);
+      }
+    }
+  }
+  // tokens including the verb
+  size_t Size() const noexcept
+  {
+    return tokens_.size();
+  }
+  const StringRef &operator[](size_t i) const noexcept
+  {
+    return tokens_[i];
+  }
+  // returns false unless the i-th token is an unsigned 64-bit integer
+  bool Uint64(size_t i, uint64_t *value) const
+  {
+    std::string token(tokens_[i].data, tokens_[i].size);
+    if (token.empty() || token[0] == '-') {
+      return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    *value = std::strtoull(token.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+  }
+  // the whole command
+  const StringRef &Raw() const noexcept
+  {
+    return raw_;
+  }
+  // the index of the Raft entry carrying the command
+  uint64_t Index() const noexcept
+  {
+    return index_;
+  }
+ private:
+  StringRef raw_;
+  uint64_t index_ = 0;
+  std::vector<StringRef> tokens_;
+};
+
+// a command of a state machine, args counts the tokens after the verb
+template<typename Derived>
+struct CommandSpec {
+  const char *verb;
+  size_t minArgs;
+  size_t maxArgs;
+  uint64_t (Derived::*handler)(const CommandArgs &args);
+};
+
+// CommandTable maps the verbs of the commands to their handlers with one hash
+// and usually one probe into an open addressing table, the verb is compared
+// once to rule out hash collisions
+template<typename Derived>
+class CommandTable {
+ public:
+  CommandTable(std::initializer_list<CommandSpec<Derived>> specs)
+    : specs_(specs)
+  {
+    size_t size = 4;
+    while (size < specs_.size() * 2) {
+      size <<= 1;
+    }
+    slots_.assign(size, Slot{0, nullptr});
+    for (auto &spec : specs_) {
+      auto h = commandHash(spec.verb);
+      auto i = h & (size - 1);
+      while (slots_[i].spec != nullptr) {
+        i = (i + 1) & (size - 1);
+      }
+      slots_[i] = Slot{h, &spec};
+    }
+  }
+  // nullptr if verb is not in the table
+  const CommandSpec<Derived> *Find(const StringRef &verb) const noexcept
+  {
+    auto h = commandHash(verb);
+    auto mask = slots_.size() - 1;
+    for (auto i = h & mask; slots_[i].spec != nullptr; i = (i + 1) & mask) {
+      if (slots_[i].hash == h
+        && verb == StringRef(slots_[i].spec->verb,
+          std::strlen(slots_[i].spec->verb))) {
+        return slots_[i].spec;
+      }
+    }
+    return nullptr;
+  }
+ private:
+  struct Slot {
+    uint64_t hash;
+    const CommandSpec<Derived> *spec;
+  };
+  const std::vector<CommandSpec<Derived>> specs_;
+  std::vector<Slot> slots_;
+};
+
+// LookupResultPool recycles the buffers of small lookup results, results
+// larger than bufferBytes are allocated and freed as usual
+class LookupResultPool {
+ public:
+  explicit LookupResultPool(size_t bufferBytes = 256, size_t maxPooled = 1024)
+    : bufferBytes_(bufferBytes), maxPooled_(maxPooled)
+  {}
+  ~LookupResultPool()
+  {
+    for (auto buffer : free_) {
+      delete[] buffer;
+    }
+  }
+  LookupResult Make(const char *data, size_t size)
+  {
+    LookupResult r;
+    r.result = nullptr;
+    r.size = size;
+    if (size <= bufferBytes_) {
+      std::lock_guard<std::mutex> guard(mtx_);
+      if (!free_.empty()) {
+        r.result = free_.back();
+        free_.pop_back();
+      }
+    }
+    if (r.result == nullptr) {
+      r.result = new char[size <= bufferBytes_ ? bufferBytes_ : size];
+    }
+    if (size != 0) {
+      std::memcpy(r.result, data, size);
+    }
+    return r;
+  }
+  void Free(LookupResult r) noexcept
+  {
+    if (r.size <= bufferBytes_) {
+      std::lock_guard<std::mutex> guard(mtx_);
+      if (free_.size() < maxPooled_) {
+        free_.push_back(r.result);
+        return;
+      }
+    }
+    delete[] r.result;
+  }
+ private:
+  const size_t bufferBytes_;
+  const size_t maxPooled_;
+  std::mutex mtx_;
+  std::vector<char *> free_;
+};
+
+// RegularStateMachineBase implements the dragonboat plumbing of a regular
+// state machine for Derived, which provides:
+//   static const CommandTable<Derived> &commands();
+//   uint64_t fallback(const CommandArgs &args);  // optional, for commands
+//                                                // not in the table
+//   void applied(uint64_t index);  // optional, after each entry
+//   void query(const StringRef &query, std::string *result) const;
+//   uint64_t hash() const;
+//   bool save(SnapshotStreamWriter *stream) const;
+//   bool recover(SnapshotStreamReader *stream);
+//   static constexpr size_t resultBits;  // optional, see proposalbatcher.h
+// Commands are dispatched through the table without virtual calls or string
+// compares, the commands of batch entries are applied in order, lookup
+// results come from a pool and snapshots go through the snapshot stream,
+// reporting SNAPSHOT_STOPPED if the node stops before or while they run.
+template<typename Derived>
+class RegularStateMachineBase : public dragonboat::RegularStateMachine {
+ public:
+  RegularStateMachineBase(
+    uint64_t clusterID,
+    uint64_t nodeID,
+    SnapshotCodec codec = CODEC_NONE) noexcept
+    : RegularStateMachine(clusterID, nodeID), codec_(codec)
+  {}
+  // bits of each command result in the result of a batch entry
+  static constexpr size_t resultBits = 1;
+ protected:
+  void update(dragonboat::Entry &ent) noexcept override
+  {
+    auto data = reinterpret_cast<const char *>(ent.cmd);
+    if (!isBatch(data, ent.cmdLen)) {
+      ent.result = apply(data, ent.cmdLen, ent.index);
+    } else if (decodeBatch(data, ent.cmdLen,
+      maxBatchCommands(Derived::resultBits), &batch_)) {
+      ent.result = 0;
+      for (size_t i = 0; i < batch_.size(); ++i) {
+        ent.result = packBatchResult(
+          ent.result, i, Derived::resultBits,
+          apply(batch_[i].data, batch_[i].size, ent.index));
+      }
+    } else {
+      // malformed or oversized, every command of the batch is rejected
+      ent.result = 0;
+    }
+    derived().applied(ent.index);
+  }
+  LookupResult lookup(
+    const dragonboat::Byte *data,
+    size_t size) const noexcept override
+  {
+    // reused by the lookups of each thread
+    static thread_local std::string result;
+    result.clear();
+    derived().query(
+      StringRef(reinterpret_cast<const char *>(data), size), &result);
+    return pool_.Make(result.data(), result.size());
+  }
+  uint64_t getHash() const noexcept override
+  {
+    return derived().hash();
+  }
+  SnapshotResult saveSnapshot(
+    dragonboat::SnapshotWriter *writer,
+    dragonboat::SnapshotFileCollection *collection,
+    const dragonboat::DoneChan &done) const noexcept override
+  {
+    SnapshotResult r;
+    r.errcode = SNAPSHOT_OK;
+    r.size = 0;
+    if (done.Closed()) {
+      r.errcode = SNAPSHOT_STOPPED;
+      return r;
+    }
+    SnapshotStreamWriter stream(
+      [writer](const char *data, size_t size)
+      {
+        auto ret = writer->Write(
+          reinterpret_cast<const dragonboat::Byte *>(data), size);
+        return static_cast<size_t>(ret.size) == size;
+      }, codec_);
+    if (!derived().save(&stream)) {
+      r.errcode = done.Closed() ? SNAPSHOT_STOPPED : FAILED_TO_SAVE_SNAPSHOT;
+      return r;
+    }
+    // the node may have stopped while the state was serialized
+    if (done.Closed()) {
+      r.errcode = SNAPSHOT_STOPPED;
+      return r;
+    }
+    if (!stream.Close()) {
+      r.errcode = FAILED_TO_SAVE_SNAPSHOT;
+      return r;
+    }
+    r.size = stream.StoredBytes();
+    std::cout << "snapshot saved: " << stream.ToString() << std::endl;
+    return r;
+  }
+  int recoverFromSnapshot(
+    dragonboat::SnapshotReader *reader,
+    const std::vector<dragonboat::SnapshotFile> &files,
+    const dragonboat::DoneChan &done) noexcept override
+  {
+    SnapshotStreamReader stream(
+      [reader](char *data, size_t size) -> int64_t
+      {
+        auto ret =
+          reader->Read(reinterpret_cast<dragonboat::Byte *>(data), size);
+        return ret.error != 0 ? -1 : static_cast<int64_t>(ret.size);
+      });
+    if (done.Closed()) {
+      return SNAPSHOT_STOPPED;
+    }
+    if (!derived().recover(&stream)) {
+      return done.Closed()
+        ? SNAPSHOT_STOPPED : FAILED_TO_RECOVER_FROM_SNAPSHOT;
+    }
+    return SNAPSHOT_OK;
+  }
+  void freeLookupResult(LookupResult r) noexcept override
+  {
+    pool_.Free(r);
+  }
+  // the result of commands not in the table or with a wrong number of args
+  uint64_t fallback(const CommandArgs &args)
+  {
+    return 0;
+  }
+  void applied(uint64_t index)
+  {}
+ private:
+  Derived &derived() noexcept
+  {
+    return *static_cast<Derived *>(this);
+  }
+  const Derived &derived() const noexcept
+  {
+    return *static_cast<const Derived *>(this);
+  }
+  uint64_t apply(const char *data, size_t size, uint64_t index)
+  {
+    args_.Parse(data, size, index);
+    if (args_.Size() == 0) {
+      return derived().fallback(args_);
+    }
+    auto spec = Derived::commands().Find(args_[0]);
+    if (spec == nullptr || args_.Size() - 1 < spec->minArgs
+      || args_.Size() - 1 > spec->maxArgs) {
+      return derived().fallback(args_);
+    }
+    return (derived().*(spec->handler))(args_);
+  }
+  const SnapshotCodec codec_;
+  // reused by update, which is never invoked concurrently
+  CommandArgs args_;
+  std::vector<StringRef> batch_;
+  mutable LookupResultPool pool_;
+};
+
+template<typename Derived>
+constexpr size_t RegularStateMachineBase<Derived>::resultBits;
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_STATEMACHINEBASE_H_
@@ -0,0 +1,88 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include "ticker.h"
+
+Ticker::Ticker(
+  dragonboat::NodeHost *nh,
+  std::vector<uint64_t> clusterIDs,
+  uint64_t intervalMillis,
+  dragonboat::Milliseconds timeout,
+  StaleReader *stale,
+  Demand needed)
+  : nh_(nh), clusterIDs_(std::move(clusterIDs)),
+    intervalMillis_(intervalMillis), timeout_(timeout), stale_(stale),
+    needed_(std::move(needed)), stopped_(false), ticks_(0)
+{
+  if (intervalMillis_ != 0) {
+    thread_ = std::thread(&Ticker::run, this);
+  }
+}
+
+Ticker::~Ticker()
+{
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+uint64_t Ticker::Ticks() const noexcept
+{
+  return ticks_;
+}
+
+void Ticker::run()
+{
+  std::mt19937_64 rng(std::random_device{}());
+  std::uniform_int_distribution<uint64_t> jitter(
+    intervalMillis_ / 2, intervalMillis_);
+  std::vector<std::unique_ptr<dragonboat::Session>> sessions;
+  for (auto clusterID : clusterIDs_) {
+    sessions.emplace_back(nh_->GetNoOPSession(clusterID));
+  }
+  std::unique_lock<std::mutex> lk(mtx_);
+  while (!cv_.wait_for(
+    lk, std::chrono::milliseconds(std::max<uint64_t>(jitter(rng), 1)),
+    [this]() { return stopped_; })) {
+    lk.unlock();
+    for (size_t i = 0; i < clusterIDs_.size(); ++i) {
+      auto clusterID = clusterIDs_[i];
+      if (!needed_(clusterID)
+        || stale_->Staleness(clusterID) < intervalMillis_) {
+        continue;
+      }
+      auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+      auto cmd = "tick " + std::to_string(now);
+      dragonboat::Buffer tick(
+        reinterpret_cast<const dragonboat::Byte *>(cmd.c_str()), cmd.size());
+      dragonboat::UpdateResult ret;
+      if (nh_->SyncPropose(sessions[i].get(), tick, timeout_, &ret).OK()) {
+        ticks_++;
+      }
+    }
+    lk.lock();
+  }
+}
@@ -0,0 +1,64 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_TICKER_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_TICKER_H_
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+#include "dragonboat/dragonboat.h"
+#include "stalereader.h"
+
+// Ticker advances the Raft-applied time of the clusters by proposing
+// "tick unix_ms" commands. A cluster is only ticked while needed(clusterID)
+// returns true and the applied time of the local state machine lags by at
+// least one interval, and the nodes check at random points of the interval,
+// so an idle cluster gets no entries and usually a single node proposes the
+// tick the other nodes then see applied.
+class Ticker {
+ public:
+  using Demand = std::function<bool(uint64_t)>;
+  // stale reads the applied time of the local state machines
+  Ticker(
+    dragonboat::NodeHost *nh,
+    std::vector<uint64_t> clusterIDs,
+    uint64_t intervalMillis,
+    dragonboat::Milliseconds timeout,
+    StaleReader *stale,
+    Demand needed);
+  // stops the ticker thread
+  ~Ticker();
+  uint64_t Ticks() const noexcept;
+ private:
+  void run();
+  dragonboat::NodeHost *nh_;
+  const std::vector<uint64_t> clusterIDs_;
+  const uint64_t intervalMillis_;
+  const dragonboat::Milliseconds timeout_;
+  StaleReader *stale_;
+  Demand needed_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool stopped_;
+  std::atomic<uint64_t> ticks_;
+  std::thread thread_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_TICKER_H_
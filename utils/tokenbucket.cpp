@@ -0,0 +1,56 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "tokenbucket.h"
+
+static uint64_t nowMicros() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TokenBucket::TokenBucket(uint64_t bytesPerSec) noexcept
+  : bytesPerSec_(std::max<uint64_t>(bytesPerSec, 1)),
+    available_(static_cast<double>(bytesPerSec_)), lastMicros_(nowMicros())
+{
+}
+
+void TokenBucket::Request(uint64_t bytes)
+{
+  double waitMicros = 0;
+  {
+    std::lock_guard<std::mutex> guard(mtx_);
+    auto now = nowMicros();
+    available_ = std::min(
+      static_cast<double>(bytesPerSec_),
+      available_ + (now - lastMicros_) * bytesPerSec_ / 1e6);
+    lastMicros_ = now;
+    available_ -= bytes;
+    if (available_ < 0) {
+      waitMicros = -available_ * 1e6 / bytesPerSec_;
+    }
+  }
+  if (waitMicros > 0) {
+    std::this_thread::sleep_for(
+      std::chrono::microseconds(static_cast<uint64_t>(waitMicros)));
+  }
+}
+
+uint64_t TokenBucket::BytesPerSec() const noexcept
+{
+  return bytesPerSec_;
+}
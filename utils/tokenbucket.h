@@ -0,0 +1,38 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_TOKENBUCKET_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_TOKENBUCKET_H_
+
+#include <mutex>
+#include <cstdint>
+
+// TokenBucket limits the rate of background IO such as snapshot scans, the
+// bucket holds at most one second of tokens and a request larger than the
+// tokens available borrows from the future and sleeps until repaid
+class TokenBucket {
+ public:
+  explicit TokenBucket(uint64_t bytesPerSec) noexcept;
+  // blocks until bytes are allowed at the configured rate
+  void Request(uint64_t bytes);
+  uint64_t BytesPerSec() const noexcept;
+ private:
+  const uint64_t bytesPerSec_;
+  std::mutex mtx_;
+  // may be negative while requests are sleeping off their debt
+  double available_;
+  uint64_t lastMicros_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_TOKENBUCKET_H_
@@ -21,4 +21,17 @@
 
 std::vector<std::string> split(const std::string &cmd, const char &delim = ' ');
 
+// lookups of something other than a key, such as stats, are tagged with a
+// leading NUL, which the state machines never accept at the start of a key,
+// so that the queries do not hide keys of the same name
+inline std::string taggedQuery(const std::string &name)
+{
+  return std::string(1, '\0') + name;
+}
+
+inline bool isReservedKey(const std::string &key)
+{
+  return !key.empty() && key[0] == '\0';
+}
+
 #endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_UTILS_H_
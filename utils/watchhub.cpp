@@ -0,0 +1,162 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+#include <algorithm>
+#include "watchhub.h"
+
+std::string formatWatchEvent(const WatchEvent &event)
+{
+  std::stringstream ss;
+  switch (event.type) {
+    case WATCH_PUT:ss << "put " << event.key << "=" << event.value;
+      break;
+    case WATCH_DELETE:ss << "del " << event.key;
+      break;
+    case WATCH_DELETE_RANGE:
+      ss << "delrange [" << event.key << ", " << event.value << ")";
+      break;
+    case WATCH_MERGE:ss << "merge " << event.key << " " << event.value;
+      break;
+    case WATCH_RESYNC:ss << "resync";
+      break;
+  }
+  ss << " @" << event.index;
+  return ss.str();
+}
+
+Subscription::Subscription(std::string key, bool prefix, size_t capacity)
+  : key_(std::move(key)), prefix_(prefix), ring_(capacity), dropped_(0),
+    waiting_(false)
+{
+}
+
+bool Subscription::Wait(WatchEvent *event, std::chrono::milliseconds timeout)
+{
+  if (ring_.TryPop(event)) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lk(mtx_);
+  // waiting_ is set before checking the ring again and the producer checks
+  // waiting_ after pushing, so one of them sees the other
+  waiting_ = true;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool popped = cv_.wait_for(lk, timeout, [this, event]()
+  {
+    return ring_.TryPop(event);
+  });
+  waiting_ = false;
+  return popped;
+}
+
+bool Subscription::TryPop(WatchEvent *event)
+{
+  return ring_.TryPop(event);
+}
+
+uint64_t Subscription::Dropped() const noexcept
+{
+  return dropped_.load();
+}
+
+static bool hasPrefix(const std::string &s, const std::string &prefix)
+{
+  return s.size() >= prefix.size()
+    && s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// the smallest key greater than all keys with the prefix, empty if none
+static std::string prefixEnd(std::string prefix)
+{
+  while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) {
+    prefix.pop_back();
+  }
+  if (!prefix.empty()) {
+    prefix.back() = static_cast<char>(prefix.back() + 1);
+  }
+  return prefix;
+}
+
+bool Subscription::matches(const WatchEvent &event) const
+{
+  if (event.type == WATCH_RESYNC) {
+    return true;
+  }
+  if (event.type != WATCH_DELETE_RANGE) {
+    return prefix_ ? hasPrefix(event.key, key_) : event.key == key_;
+  }
+  // [key, value) overlaps the watched key or the keys with the prefix
+  bool beforeEnd = event.value.empty() || key_ < event.value;
+  if (!prefix_) {
+    return event.key <= key_ && beforeEnd;
+  }
+  auto end = prefixEnd(key_);
+  return beforeEnd && (end.empty() || event.key < end);
+}
+
+void Subscription::push(const WatchEvent &event)
+{
+  WatchEvent copy(event);
+  if (!ring_.TryPush(std::move(copy))) {
+    dropped_++;
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_) {
+    std::lock_guard<std::mutex> guard(mtx_);
+    cv_.notify_one();
+  }
+}
+
+WatchHub::WatchHub()
+  : subs_(std::make_shared<const Subscriptions>())
+{
+}
+
+std::shared_ptr<Subscription> WatchHub::Subscribe(
+  const std::string &key,
+  bool prefix,
+  size_t capacity)
+{
+  auto sub = std::make_shared<Subscription>(key, prefix, capacity);
+  std::lock_guard<std::mutex> guard(mtx_);
+  auto subs = std::make_shared<Subscriptions>(*std::atomic_load(&subs_));
+  subs->push_back(sub);
+  std::atomic_store(&subs_, std::shared_ptr<const Subscriptions>(subs));
+  return sub;
+}
+
+void WatchHub::Unsubscribe(const std::shared_ptr<Subscription> &sub)
+{
+  std::lock_guard<std::mutex> guard(mtx_);
+  auto subs = std::make_shared<Subscriptions>(*std::atomic_load(&subs_));
+  subs->erase(std::remove(subs->begin(), subs->end(), sub), subs->end());
+  std::atomic_store(&subs_, std::shared_ptr<const Subscriptions>(subs));
+}
+
+bool WatchHub::Active() const noexcept
+{
+  return !std::atomic_load(&subs_)->empty();
+}
+
+void WatchHub::Publish(const WatchEvent &event)
+{
+  auto subs = std::atomic_load(&subs_);
+  for (auto &sub : *subs) {
+    if (sub->matches(event)) {
+      sub->push(event);
+    }
+  }
+}
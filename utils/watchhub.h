@@ -0,0 +1,105 @@
+// Copyright 2019 JasonYuchen (jasonyuchen@foxmail.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef DRAGONBOAT_CPP_EXAMPLE_UTILS_WATCHHUB_H_
+#define DRAGONBOAT_CPP_EXAMPLE_UTILS_WATCHHUB_H_
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include "spscring.h"
+
+enum WatchEventType : int {
+  WATCH_PUT = 0,
+  WATCH_DELETE = 1,
+  // deletes [key, value)
+  WATCH_DELETE_RANGE = 2,
+  // an operation whose result is not known to the state machine, e.g. a
+  // blind merge, value describes the operation
+  WATCH_MERGE = 3,
+  // the state machine was replaced by a snapshot, any key may have changed,
+  // delivered to all subscriptions with an empty key
+  WATCH_RESYNC = 4,
+};
+
+struct WatchEvent {
+  // the index of the Raft entry applying the change
+  uint64_t index;
+  WatchEventType type;
+  std::string key;
+  // the new value of a put, the operation of a merge, the end of a deleted
+  // range or empty if the range has no end
+  std::string value;
+};
+
+// e.g. "put key=value @index"
+std::string formatWatchEvent(const WatchEvent &event);
+
+// Subscription receives the events of the keys equal to or prefixed by its
+// key and every WATCH_RESYNC, it is consumed by one thread at a time
+class Subscription {
+ public:
+  Subscription(std::string key, bool prefix, size_t capacity);
+  // returns false if no event arrived within timeout
+  bool Wait(WatchEvent *event, std::chrono::milliseconds timeout);
+  bool TryPop(WatchEvent *event);
+  // events dropped because the ring was full, the consumer has to read the
+  // watched keys again to catch up once it changes
+  uint64_t Dropped() const noexcept;
+ private:
+  friend class WatchHub;
+  bool matches(const WatchEvent &event) const;
+  // producer side, wakes up the consumer if it is waiting
+  void push(const WatchEvent &event);
+  const std::string key_;
+  const bool prefix_;
+  SPSCRing<WatchEvent> ring_;
+  std::atomic<uint64_t> dropped_;
+  // set by a consumer about to sleep, the producer only takes mtx_ to notify
+  // it when set
+  std::atomic<bool> waiting_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
+// WatchHub delivers the changes applied by one state machine to its
+// subscriptions, Publish is called by the apply path of that state machine
+// only and never blocks on a consumer, Subscribe and Unsubscribe can be
+// called concurrently with it
+class WatchHub {
+ public:
+  WatchHub();
+  std::shared_ptr<Subscription> Subscribe(
+    const std::string &key,
+    bool prefix,
+    size_t capacity = 1024);
+  void Unsubscribe(const std::shared_ptr<Subscription> &sub);
+  // true if some subscription exists, lets the apply path skip building
+  // events nobody watches
+  bool Active() const noexcept;
+  void Publish(const WatchEvent &event);
+ private:
+  using Subscriptions = std::vector<std::shared_ptr<Subscription>>;
+  // replaced as a whole under mtx_ and read with std::atomic_load
+  std::shared_ptr<const Subscriptions> subs_;
+  std::mutex mtx_;
+};
+
+#endif //DRAGONBOAT_CPP_EXAMPLE_UTILS_WATCHHUB_H_